@@ -1,187 +1,3821 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <atomic>
+#if __has_include(<bit>)
+#include <bit>
+#endif
+#include <cstdint>
+#include <chrono>
+#include <cmath>
+#if __has_include(<concepts>)
+#include <concepts>
+#endif
+#include <condition_variable>
+#include <cstring>
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
 #include <functional>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <optional>
+#if __has_include(<span>)
+#include <span>
+#endif
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
-/// A movable wrapper around std::atomic<bool>.
+/// ADAPTIVE_POOL_ENABLE_METRICS, ADAPTIVE_POOL_ENABLE_TRACING and
+/// ADAPTIVE_POOL_DEBUG_OWNERSHIP add members to the pool, as does
+/// std::atomic<std::shared_ptr> where the library has it. Everything this
+/// header and sharded_adaptive_resource_pool.hpp declare lives in an inline
+/// namespace named after that configuration, so translation units built with
+/// different settings link against distinct types instead of silently
+/// sharing one layout. Code that forward-declares these types must use
+/// ADAPTIVE_POOL_ABI_NAMESPACE.
+#if defined(ADAPTIVE_POOL_ENABLE_METRICS)
+#define ADAPTIVE_POOL_ABI_METRICS m1
+#else
+#define ADAPTIVE_POOL_ABI_METRICS m0
+#endif
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+#define ADAPTIVE_POOL_ABI_TRACING t1
+#else
+#define ADAPTIVE_POOL_ABI_TRACING t0
+#endif
+#if defined(ADAPTIVE_POOL_DEBUG_OWNERSHIP)
+#define ADAPTIVE_POOL_ABI_OWNERSHIP o1
+#else
+#define ADAPTIVE_POOL_ABI_OWNERSHIP o0
+#endif
+#if defined(__cpp_lib_atomic_shared_ptr)
+#define ADAPTIVE_POOL_ABI_POLICY a1
+#else
+#define ADAPTIVE_POOL_ABI_POLICY a0
+#endif
+#define ADAPTIVE_POOL_ABI_JOIN_(m, t, o, a) adaptive_pool_abi_##m##t##o##a
+#define ADAPTIVE_POOL_ABI_JOIN(m, t, o, a) ADAPTIVE_POOL_ABI_JOIN_(m, t, o, a)
+#define ADAPTIVE_POOL_ABI_NAMESPACE                                                                          \
+    ADAPTIVE_POOL_ABI_JOIN(ADAPTIVE_POOL_ABI_METRICS, ADAPTIVE_POOL_ABI_TRACING, ADAPTIVE_POOL_ABI_OWNERSHIP, \
+                           ADAPTIVE_POOL_ABI_POLICY)
+
+inline namespace ADAPTIVE_POOL_ABI_NAMESPACE {
+
+/// A movable wrapper around std::atomic<U>.
 /// Standard std::atomic is neither copyable nor movable, so this
 /// helper allows moving by copying the value in a relaxed manner.
-struct MovableAtomicBool {
-    std::atomic<bool> v;
+template<typename U>
+struct MovableAtomic {
+    std::atomic<U> v;
+
+    explicit MovableAtomic(U u = U {}) noexcept: v(u) {}
+
+    U load(std::memory_order m = std::memory_order_seq_cst) const noexcept {
+        return v.load(m);
+    }
+
+    void store(U u, std::memory_order m = std::memory_order_seq_cst) noexcept {
+        v.store(u, m);
+    }
+
+    U exchange(U u, std::memory_order m = std::memory_order_seq_cst) noexcept {
+        return v.exchange(u, m);
+    }
+
+    bool compare_exchange_strong(
+        U& expected,
+        U desired,
+        std::memory_order m = std::memory_order_seq_cst
+    ) noexcept {
+        return v.compare_exchange_strong(expected, desired, m);
+    }
+
+    // Move constructor: copies the current value
+    MovableAtomic(MovableAtomic&& o) noexcept: v(o.v.load(std::memory_order_relaxed)) {}
+
+    // Move assignment: copies the current value
+    MovableAtomic& operator=(MovableAtomic&& o) noexcept {
+        v.store(o.v.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    MovableAtomic(const MovableAtomic&) = delete;
+    MovableAtomic& operator=(const MovableAtomic&) = delete;
+};
+
+/// A movable wrapper around std::atomic<bool>.
+using MovableAtomicBool = MovableAtomic<bool>;
+
+/// Cache line size assumed for padding hot shared state.
+/// std::hardware_destructive_interference_size is deliberately not used: its
+/// value depends on -mtune, which would make the pool layout ABI-unstable.
+inline constexpr size_t kAdaptivePoolCacheLineSize = 64;
+
+/// A counter split over cache-line-sized stripes, each thread adding to its
+/// own, so that threads updating it at high rates do not write one shared
+/// line. Reads sum every stripe and are a snapshot, like a relaxed load.
+class StripedCounter {
+public:
+    void add(int64_t delta) noexcept {
+        stripes_[stripe()].value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    /// Sum of the stripes; never negative, although a stripe may be.
+    size_t load() const noexcept {
+        int64_t sum = 0;
+        for (const Stripe& s: stripes_) {
+            sum += s.value.load(std::memory_order_relaxed);
+        }
+        return sum > 0 ? static_cast<size_t>(sum) : 0;
+    }
+
+    /// Sets the counter. Not atomic with respect to concurrent add() calls.
+    void store(size_t value) noexcept {
+        for (Stripe& s: stripes_) {
+            s.value.store(0, std::memory_order_relaxed);
+        }
+        stripes_[0].value.store(static_cast<int64_t>(value), std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t kStripes = 8;
+
+    struct alignas(kAdaptivePoolCacheLineSize) Stripe {
+        std::atomic<int64_t> value { 0 };
+    };
+
+    /// Stripe of the calling thread, handed out round-robin.
+    static size_t stripe() noexcept {
+        static std::atomic<size_t> next { 0 };
+        static thread_local const size_t mine = next.fetch_add(1, std::memory_order_relaxed) % kStripes;
+        return mine;
+    }
+
+    Stripe stripes_[kStripes];
+};
+
+/// Memory layout of the per-slot state and generation words.
+enum class SlotLayout {
+    Packed, ///< Adjacent words; smallest footprint, neighbours share a cache line
+    Padded, ///< One cache line per slot; no false sharing between slots
+};
+
+/// How the pool creates its initial resources.
+enum class WarmupMode {
+    Eager,    ///< resource_initializer runs in the constructor
+    Lazy,     ///< Params::initial_size slots are created by restore_func on first demand
+    Parallel, ///< Params::initial_size slots are created by restore_func in the background
+};
+
+/// Priority class of an acquire. Queued callers are served highest class
+/// first, FIFO within a class; see also Params::reserved_for_high and
+/// Params::priority_quota.
+enum class AcquirePriority : uint8_t {
+    High,   ///< Latency-critical; may take the reserved resources
+    Normal, ///< Default for acquires that name no class
+    Low,    ///< Background or batch work
+};
+
+/// Number of AcquirePriority classes.
+inline constexpr size_t kAcquirePriorityCount = 3;
+
+/// Severity of a pool log event.
+enum class PoolLogLevel : uint8_t {
+    Debug,
+    Info,
+    Warning,
+    Error,
+    Off, ///< Threshold that suppresses every event
+};
+
+/// Compile-time log threshold: events below it are compiled out entirely.
+/// Define ADAPTIVE_POOL_DISABLE_LOGGING, or ADAPTIVE_POOL_MIN_LOG_LEVEL to the
+/// numeric value of a PoolLogLevel, before including this header.
+#if !defined(ADAPTIVE_POOL_MIN_LOG_LEVEL)
+#if defined(ADAPTIVE_POOL_DISABLE_LOGGING)
+#define ADAPTIVE_POOL_MIN_LOG_LEVEL 4
+#else
+#define ADAPTIVE_POOL_MIN_LOG_LEVEL 0
+#endif
+#endif
+
+inline constexpr PoolLogLevel kAdaptivePoolMinLogLevel =
+    static_cast<PoolLogLevel>(ADAPTIVE_POOL_MIN_LOG_LEVEL);
+
+/// Define ADAPTIVE_POOL_DEBUG_OWNERSHIP before including this header to record
+/// the thread each resource was handed to. Releases from any other thread are
+/// then reported as PoolEvent::ForeignRelease, and ownerOf() names the holder.
+#if defined(ADAPTIVE_POOL_DEBUG_OWNERSHIP)
+inline constexpr bool kAdaptivePoolDebugOwnership = true;
+#else
+inline constexpr bool kAdaptivePoolDebugOwnership = false;
+#endif
+
+/// Events reported through Params::event_logger and Params::logger.
+enum class PoolEvent : uint8_t {
+    Restored,       ///< restore_func filled the slot
+    RestoreFailed,  ///< restore_func returned nullptr or threw; the slot backs off
+    Released,       ///< release_func emptied the slot
+    ReleaseFailed,  ///< release_func threw; the resource was destroyed anyway
+    UnknownRelease, ///< release() was passed a resource the pool does not own
+    Destroyed,      ///< The pool has been destroyed
+    Invalidated,    ///< validate rejected the resource; it is released and restored
+    StaleRelease,   ///< A slot was released twice, or through a handle after it changed hands
+    ForeignRelease, ///< Released by a thread other than the one that acquired it (debug ownership)
+};
+
+/// Fixed severity of each event.
+constexpr PoolLogLevel poolEventLevel(PoolEvent event) noexcept {
+    switch (event) {
+    case PoolEvent::RestoreFailed:
+    case PoolEvent::ReleaseFailed:
+    case PoolEvent::UnknownRelease:
+    case PoolEvent::Invalidated:
+    case PoolEvent::StaleRelease:
+    case PoolEvent::ForeignRelease:
+        return PoolLogLevel::Warning;
+    default:
+        return PoolLogLevel::Info;
+    }
+}
+
+/// A structured log event. Building one costs no allocation.
+struct PoolLogRecord {
+    static constexpr size_t kNoSlot = static_cast<size_t>(-1);
+
+    PoolEvent event;
+    PoolLogLevel level;
+    size_t index = kNoSlot; ///< Slot concerned, or kNoSlot
+};
+
+/// Formats `record` as the text passed to Params::logger.
+inline std::string formatPoolEvent(const PoolLogRecord& record) {
+    const std::string slot = "resource[" + std::to_string(record.index) + "]";
+    switch (record.event) {
+    case PoolEvent::Restored:
+        return "Restored " + slot;
+    case PoolEvent::RestoreFailed:
+        return "Failed to restore " + slot;
+    case PoolEvent::Released:
+        return "Released " + slot;
+    case PoolEvent::ReleaseFailed:
+        return "release_func threw for " + slot;
+    case PoolEvent::UnknownRelease:
+        return "Tried to release unknown resource.";
+    case PoolEvent::Destroyed:
+        return "AdaptiveResourcePool destroyed.";
+    case PoolEvent::Invalidated:
+        return "Validation failed for " + slot;
+    case PoolEvent::StaleRelease:
+        return "Rejected stale or repeated release of " + slot;
+    case PoolEvent::ForeignRelease:
+        return slot + " released by a thread other than its owner";
+    }
+    return {};
+}
+
+/// Log-linear latency histogram in the style of HdrHistogram.
+/// Values below kSubBuckets nanoseconds have exact buckets; above that, every
+/// power of two is split into kSubBuckets buckets, bounding the relative error
+/// to 1 / kSubBuckets. Recording is a few relaxed atomic increments.
+class PoolLatencyHistogram {
+public:
+    static constexpr unsigned kSubBucketBits = 3;
+    static constexpr size_t kSubBuckets = size_t { 1 } << kSubBucketBits;
+    static constexpr size_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    /// Point-in-time copy of a histogram.
+    struct Snapshot {
+        uint64_t count = 0;            ///< Recorded values
+        uint64_t sum_ns = 0;           ///< Sum of recorded values
+        std::vector<uint64_t> buckets; ///< Values per bucket; empty if nothing was recorded
+
+        /// Upper bound, in nanoseconds, of the bucket holding quantile `q` (0..1).
+        uint64_t percentile(double q) const {
+            if (count == 0)
+                return 0;
+            const double target = std::max(1.0, q * static_cast<double>(count));
+            uint64_t seen = 0;
+            for (size_t b = 0; b < buckets.size(); ++b) {
+                seen += buckets[b];
+                if (static_cast<double>(seen) >= target)
+                    return bucketUpperBound(b);
+            }
+            return bucketUpperBound(buckets.size() - 1);
+        }
+    };
+
+    /// Bucket holding `ns`.
+    static size_t bucketOf(uint64_t ns) noexcept {
+        if (ns < kSubBuckets)
+            return static_cast<size_t>(ns);
+        unsigned msb = 63;
+        while ((ns >> msb) == 0) {
+            --msb;
+        }
+        const unsigned shift = msb - kSubBucketBits;
+        return (shift + 1) * kSubBuckets + static_cast<size_t>((ns >> shift) & (kSubBuckets - 1));
+    }
+
+    /// Largest value that falls into bucket `b`, in nanoseconds.
+    static uint64_t bucketUpperBound(size_t b) noexcept {
+        if (b < kSubBuckets)
+            return b;
+        const size_t shift = b / kSubBuckets - 1;
+        const uint64_t lower = (kSubBuckets + b % kSubBuckets) << shift;
+        return lower + ((uint64_t { 1 } << shift) - 1);
+    }
+
+    void record(uint64_t ns) noexcept {
+        buckets_[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    /// Copies the histogram. Concurrent recording may make the copy slightly
+    /// inconsistent, e.g. count differing from the bucket total.
+    Snapshot snapshot() const {
+        Snapshot snap;
+        snap.count = count_.load(std::memory_order_relaxed);
+        snap.sum_ns = sum_.load(std::memory_order_relaxed);
+        if (snap.count != 0) {
+            snap.buckets.resize(kBucketCount);
+            for (size_t b = 0; b < kBucketCount; ++b) {
+                snap.buckets[b] = buckets_[b].load(std::memory_order_relaxed);
+            }
+        }
+        return snap;
+    }
+
+private:
+    std::atomic<uint64_t> count_ { 0 };
+    std::atomic<uint64_t> sum_ { 0 };
+    std::atomic<uint64_t> buckets_[kBucketCount] {};
+};
+
+/// Snapshot of a pool's statistics, as returned by AdaptiveResourcePool::metrics().
+/// All fields stay zero unless ADAPTIVE_POOL_ENABLE_METRICS is defined.
+struct PoolMetrics {
+    uint64_t acquires = 0;        ///< Resources handed out
+    uint64_t misses = 0;          ///< Acquire calls that returned nothing, including timeouts
+    uint64_t returns = 0;         ///< Resources given back by callers
+    uint64_t restores = 0;        ///< Successful restore_func calls
+    uint64_t failed_restores = 0; ///< restore_func calls that returned nullptr
+    uint64_t releases = 0;        ///< release_func calls made by the release policy
+
+    PoolLatencyHistogram::Snapshot acquire_latency;  ///< Non-blocking acquire time
+    PoolLatencyHistogram::Snapshot wait_time;        ///< Time blocked or suspended before a hand-over
+    PoolLatencyHistogram::Snapshot hold_time;        ///< Time from acquire to return
+    PoolLatencyHistogram::Snapshot restore_duration; ///< Duration of restore_func
+    PoolLatencyHistogram::Snapshot release_duration; ///< Duration of release_func
+};
+
+#if defined(ADAPTIVE_POOL_ENABLE_METRICS)
+/// Collects PoolMetrics for a pool with lock-free counters and histograms.
+class alignas(kAdaptivePoolCacheLineSize) PoolMetricsRecorder {
+public:
+    static constexpr bool kEnabled = true;
+
+    /// Start time of a measured operation, in steady_clock nanoseconds.
+    using Stamp = uint64_t;
+
+    static Stamp now() noexcept {
+        return static_cast<Stamp>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count());
+    }
+
+    /// Records an acquisition started at `start`, which waited for a hand-over
+    /// if `waited`. Returns the time the resource was handed out.
+    Stamp onAcquire(Stamp start, bool acquired, bool waited = false) noexcept {
+        const Stamp end = now();
+        (acquired ? acquires_ : misses_).fetch_add(1, std::memory_order_relaxed);
+        (waited ? wait_time_ : acquire_latency_).record(end - start);
+        return end;
+    }
+
+    /// Records the return of a resource handed out at `acquired_at`.
+    void onReturn(Stamp acquired_at) noexcept {
+        returns_.fetch_add(1, std::memory_order_relaxed);
+        hold_time_.record(now() - acquired_at);
+    }
+
+    void onRestore(Stamp start, bool restored) noexcept {
+        (restored ? restores_ : failed_restores_).fetch_add(1, std::memory_order_relaxed);
+        restore_duration_.record(now() - start);
+    }
+
+    void onRelease(Stamp start) noexcept {
+        releases_.fetch_add(1, std::memory_order_relaxed);
+        release_duration_.record(now() - start);
+    }
+
+    PoolMetrics snapshot() const {
+        PoolMetrics m;
+        m.acquires = acquires_.load(std::memory_order_relaxed);
+        m.misses = misses_.load(std::memory_order_relaxed);
+        m.returns = returns_.load(std::memory_order_relaxed);
+        m.restores = restores_.load(std::memory_order_relaxed);
+        m.failed_restores = failed_restores_.load(std::memory_order_relaxed);
+        m.releases = releases_.load(std::memory_order_relaxed);
+        m.acquire_latency = acquire_latency_.snapshot();
+        m.wait_time = wait_time_.snapshot();
+        m.hold_time = hold_time_.snapshot();
+        m.restore_duration = restore_duration_.snapshot();
+        m.release_duration = release_duration_.snapshot();
+        return m;
+    }
+
+private:
+    std::atomic<uint64_t> acquires_ { 0 };
+    std::atomic<uint64_t> misses_ { 0 };
+    std::atomic<uint64_t> returns_ { 0 };
+    std::atomic<uint64_t> restores_ { 0 };
+    std::atomic<uint64_t> failed_restores_ { 0 };
+    std::atomic<uint64_t> releases_ { 0 };
+    PoolLatencyHistogram acquire_latency_;
+    PoolLatencyHistogram wait_time_;
+    PoolLatencyHistogram hold_time_;
+    PoolLatencyHistogram restore_duration_;
+    PoolLatencyHistogram release_duration_;
+};
+#else
+/// Metrics are compiled out: every hook is an empty inline function and
+/// takes no measurements.
+class PoolMetricsRecorder {
+public:
+    static constexpr bool kEnabled = false;
+
+    struct Stamp {};
+
+    static Stamp now() noexcept {
+        return {};
+    }
+
+    Stamp onAcquire(Stamp, bool, bool = false) noexcept {
+        return {};
+    }
+
+    void onReturn(Stamp) noexcept {}
+
+    void onRestore(Stamp, bool) noexcept {}
+
+    void onRelease(Stamp) noexcept {}
+
+    PoolMetrics snapshot() const {
+        return {};
+    }
+};
+#endif
+
+/// Operations traced when ADAPTIVE_POOL_ENABLE_TRACING is defined, each
+/// reported to Params::trace_sink as a Begin and an End event.
+enum class PoolTraceSpan : uint8_t {
+    AcquireWait, ///< Blocking or suspended acquire queued for a hand-over
+    LockWait,    ///< Waiting for the lock that serializes restore and release decisions
+    LockHold,    ///< Holding that lock
+    Restore,     ///< restore_func (or construct) of one slot
+    Release,     ///< release_func of one slot
+    Lease,       ///< Resource held by a caller, from hand-out to release
+};
+
+enum class PoolTracePhase : uint8_t {
+    Begin,
+    End,
+};
+
+/// One trace event. Spans that may end on another thread than they began
+/// (AcquireWait, Lease) carry an id shared by their Begin and End, e.g. for
+/// Perfetto async tracks or LTTng; it is zero for the others.
+struct PoolTraceEvent {
+    PoolTraceSpan span;
+    PoolTracePhase phase;
+    size_t index = static_cast<size_t>(-1); ///< Slot concerned, or -1
+    uint64_t id = 0;
+    uint64_t timestamp_ns = 0;              ///< steady_clock time of the event
+};
+
+/// Names the acquires the calling thread makes within its scope, e.g. after
+/// the request handler, for AdaptiveResourcePool::longHolders(). Scopes nest;
+/// `site` must outlive every pool that sampled it, e.g. a string literal.
+class PoolCallSite {
+public:
+    explicit PoolCallSite(const char* site) noexcept: previous_(current_) {
+        current_ = site;
+    }
+
+    ~PoolCallSite() {
+        current_ = previous_;
+    }
+
+    PoolCallSite(const PoolCallSite&) = delete;
+    PoolCallSite& operator=(const PoolCallSite&) = delete;
+
+    /// Innermost site of the calling thread, or "unlabelled".
+    static const char* current() noexcept {
+        return current_ ? current_ : "unlabelled";
+    }
+
+private:
+    static inline thread_local const char* current_ = nullptr;
+    const char* previous_;
+};
+
+/// Sampled hold times of one call site, as returned by
+/// AdaptiveResourcePool::longHolders().
+struct PoolHolderReport {
+    const char* site = nullptr;             ///< PoolCallSite of the acquires
+    uint64_t samples = 0;                   ///< Sampled hand-outs, released or not
+    uint64_t outstanding = 0;               ///< Sampled hand-outs still held
+    std::chrono::nanoseconds total_held {}; ///< Hold time summed over the samples
+    std::chrono::nanoseconds longest_held {};
+};
+
+/// Default policy of AdaptiveResourcePool: type-erased callbacks.
+///
+/// A custom policy is any class with the same five const member functions.
+/// Their calls are then resolved at compile time and can be inlined, which
+/// std::function calls on the acquire() path cannot. The pool's Params
+/// derive from the policy, so stateful policies are configured there too.
+/// Like the callbacks, the members may be called concurrently.
+template<typename T>
+struct FunctionPoolPolicy {
+    /// Initializes the initial set of resources. Only used by WarmupMode::Eager.
+    std::function<std::vector<std::unique_ptr<T>>()> resource_initializer;
+
+    /// Determines whether resources should be restored based on active count.
+    std::function<bool(size_t)> can_restore;
+
+    /// Determines whether resources should be released based on active count.
+    std::function<bool(size_t)> should_release;
+
+    /// Restores a resource at the given index.
+    /// Runs without the pool lock and may run concurrently for different slots.
+    std::function<std::unique_ptr<T>(size_t)> restore_func;
+
+    /// Releases a given resource.
+    /// Runs without the pool lock and may run concurrently for different slots.
+    std::function<void(std::unique_ptr<T>&)> release_func;
+
+    std::vector<std::unique_ptr<T>> initialize() const {
+        return resource_initializer();
+    }
+
+    bool canRestore(size_t active) const {
+        return can_restore && can_restore(active);
+    }
+
+    bool shouldRelease(size_t active) const {
+        return should_release && should_release(active);
+    }
+
+    std::unique_ptr<T> restore(size_t index) const {
+        return restore_func(index);
+    }
+
+    void release(std::unique_ptr<T>& res) const {
+        if (release_func) {
+            release_func(res);
+        }
+    }
+};
+
+/// Whether policy `P` stores resources inline: it declares
+/// `static constexpr bool kInlineStorage = true`.
+template<typename P, typename = void>
+inline constexpr bool kPolicyStoresInline = false;
+
+template<typename P>
+inline constexpr bool kPolicyStoresInline<P, std::void_t<decltype(P::kInlineStorage)>> = P::kInlineStorage;
+
+/// Policy that stores resources inline in the pool's slot chunks, 64 per
+/// cache-aligned arena, instead of one heap allocation each. Restoring a
+/// slot constructs the resource in place and releasing it destroys it in
+/// place, so neither allocates, and the resources of a chunk lie next to
+/// each other in memory.
+///
+/// A custom inline policy declares kInlineStorage and replaces initialize(),
+/// restore() and release() of FunctionPoolPolicy with construct() and
+/// release(T&) below. WarmupMode::Eager then constructs
+/// Params::initial_size resources in the constructor.
+template<typename T>
+struct InlineFunctionPoolPolicy {
+    static constexpr bool kInlineStorage = true;
+
+    /// Constructs a resource for the given slot index in place, at the
+    /// uninitialized storage passed in. Returns false, having constructed
+    /// nothing, if it failed. Unset, T is value-initialized.
+    /// Runs without the pool lock and may run concurrently for different slots.
+    std::function<bool(T*, size_t)> construct_func;
+
+    /// Called before the pool destroys a resource in place.
+    /// Runs without the pool lock and may run concurrently for different slots.
+    std::function<void(T&)> release_func;
+
+    /// Determines whether resources should be restored based on active count.
+    std::function<bool(size_t)> can_restore;
+
+    /// Determines whether resources should be released based on active count.
+    std::function<bool(size_t)> should_release;
+
+    bool construct(T* where, size_t index) const {
+        if (construct_func)
+            return construct_func(where, index);
+        if constexpr (std::is_default_constructible_v<T>) {
+            ::new (static_cast<void*>(where)) T();
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    bool canRestore(size_t active) const {
+        return can_restore && can_restore(active);
+    }
+
+    bool shouldRelease(size_t active) const {
+        return should_release && should_release(active);
+    }
+
+    void release(T& res) const {
+        if (release_func) {
+            release_func(res);
+        }
+    }
+};
+
+/// Load of a pool, as reported to Params::load_observer.
+struct PoolLoad {
+    size_t active = 0;  ///< Resources held or being restored
+    size_t busy = 0;    ///< Resources held by callers
+    size_t idle = 0;    ///< Resources free to acquire
+    size_t waiters = 0; ///< Callers queued for a resource
+};
+
+/// Lifecycle state of a slot, as reported by AdaptiveResourcePool::snapshot().
+enum class PoolSlotStatus {
+    Idle,      ///< Holds a resource free to acquire
+    Busy,      ///< Held by a caller
+    Cached,    ///< Parked in a thread cache; counted as busy
+    Releasing, ///< Resource being torn down by release_func
+    Released,  ///< Holds no resource
+    Restoring, ///< Resource being created by restore_func
+};
+
+/// One slot of an AdaptiveResourcePool::snapshot().
+struct PoolSlotSnapshot {
+    size_t index = 0;
+    PoolSlotStatus status = PoolSlotStatus::Released;
+
+    /// When the slot was last returned. Stamped with Params::track_slot_times
+    /// or idle_ttl; otherwise the clock's epoch.
+    std::chrono::steady_clock::time_point last_used {};
+
+    /// How long a Busy slot has been held so far. Measured with
+    /// Params::track_slot_times; otherwise zero.
+    std::chrono::steady_clock::duration held_for {};
+};
+
+/// Autoscaling policy for the default FunctionPoolPolicy callbacks.
+///
+/// It smooths concurrent demand (busy resources plus queued waiters) with a
+/// time-based EWMA. Restores are allowed while fewer than current or
+/// predicted demand plus headroom are active. Releases are only allowed once
+/// the pool has stayed above smoothed demand plus headroom plus release_band
+/// for min_dwell, and then one at a time per min_dwell. The gap between the
+/// two thresholds keeps steady mid-level load from flapping between teardown
+/// and rebuild. With a non-zero lookahead, rising demand is extrapolated so
+/// resources are restored before acquire() needs them.
+///
+/// The thresholds are published through atomics, so the release and restore
+/// checks on the acquire() path take no lock.
+class HysteresisScalingPolicy {
+public:
+    struct Options {
+        /// Time for a change in demand to carry half its weight in the average.
+        std::chrono::milliseconds half_life { 1000 };
+
+        /// Spare resources kept on top of demand.
+        size_t headroom = 1;
+
+        /// Extra resources tolerated above smoothed demand before releasing.
+        size_t release_band = 1;
+
+        /// How long the pool must stay over the release threshold before each
+        /// release.
+        std::chrono::milliseconds min_dwell { 5000 };
+
+        /// How far ahead rising demand is extrapolated. Zero disables prediction.
+        std::chrono::milliseconds lookahead { 0 };
+
+        /// Bounds for the target number of active resources.
+        size_t min_active = 1;
+        size_t max_active = std::numeric_limits<size_t>::max();
+
+        /// Samples arriving sooner than this after the last processed one are
+        /// dropped on a relaxed timestamp check, without touching the mutex.
+        std::chrono::microseconds min_interval { 1000 };
+    };
+
+    HysteresisScalingPolicy(): HysteresisScalingPolicy(Options()) {}
+
+    explicit HysteresisScalingPolicy(const Options& options): options_(options) {
+        restore_below_.store(options_.min_active, std::memory_order_relaxed);
+    }
+
+    /// Points the can_restore, should_release and load_observer callbacks of
+    /// `params` at `policy`, which they keep alive.
+    template<typename Params>
+    static void install(const std::shared_ptr<HysteresisScalingPolicy>& policy, Params& params) {
+        params.can_restore = [policy](size_t active) { return policy->canRestore(active); };
+        params.should_release = [policy](size_t active) { return policy->shouldRelease(active); };
+        params.load_observer = [policy](const PoolLoad& load) { policy->observe(load); };
+    }
+
+    /// Feeds a load sample. Samples that arrive within Options::min_interval
+    /// of the last one, or while another one is being processed, are dropped.
+    void observe(const PoolLoad& load) {
+        const auto now = std::chrono::steady_clock::now();
+        const int64_t ticks = now.time_since_epoch().count();
+        if (ticks < next_sample_.load(std::memory_order_relaxed))
+            return;
+        std::unique_lock<std::mutex> lk(mutex_, std::try_to_lock);
+        if (!lk.owns_lock())
+            return;
+        next_sample_.store(
+            ticks + std::chrono::duration_cast<std::chrono::steady_clock::duration>(options_.min_interval).count(),
+            std::memory_order_relaxed
+        );
+        const double demand = static_cast<double>(load.busy + load.waiters);
+        if (!sampled_) {
+            sampled_ = true;
+            average_ = demand;
+        } else {
+            const double dt = std::chrono::duration<double>(now - last_sample_).count();
+            const double tau = std::chrono::duration<double>(options_.half_life).count() / std::log(2.0);
+            const double weight = tau > 0 ? 1.0 - std::exp(-dt / tau) : 1.0;
+            const double previous = average_;
+            average_ += weight * (demand - average_);
+            if (dt > 0) {
+                trend_ += weight * ((average_ - previous) / dt - trend_);
+            }
+        }
+        last_sample_ = now;
+
+        const double lookahead = std::chrono::duration<double>(options_.lookahead).count();
+        const double predicted = average_ + std::max(0.0, trend_) * lookahead;
+        restore_below_.store(bound(std::max(demand, predicted) + options_.headroom), std::memory_order_relaxed);
+        const size_t release_above = bound(std::max(demand, average_) + options_.headroom + options_.release_band);
+        release_above_.store(release_above, std::memory_order_relaxed);
+
+        if (load.active <= release_above) {
+            over_ = false;
+            release_token_.store(false, std::memory_order_relaxed);
+        } else if (!over_) {
+            over_ = true;
+            over_since_ = now;
+        } else if (now - over_since_ >= options_.min_dwell) {
+            // One release per dwell period scales down gradually.
+            release_token_.store(true, std::memory_order_relaxed);
+            over_since_ = now;
+        }
+    }
+
+    bool canRestore(size_t active) const {
+        return active < restore_below_.load(std::memory_order_relaxed);
+    }
+
+    bool shouldRelease(size_t active) {
+        return active > release_above_.load(std::memory_order_relaxed)
+            && release_token_.exchange(false, std::memory_order_relaxed);
+    }
+
+    /// Smoothed demand.
+    double demand() const {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return average_;
+    }
+
+    /// Number of active resources restores currently aim for.
+    size_t target() const {
+        return restore_below_.load(std::memory_order_relaxed);
+    }
+
+private:
+    size_t bound(double wanted) const {
+        const double ceiled = std::ceil(wanted);
+        const double lo = static_cast<double>(options_.min_active);
+        const double hi = static_cast<double>(options_.max_active);
+        return static_cast<size_t>(std::min(std::max(ceiled, lo), hi));
+    }
+
+    const Options options_;
+    mutable std::mutex mutex_; ///< Guards the sampling state below
+    bool sampled_ = false;
+    double average_ = 0;       ///< EWMA of demand
+    double trend_ = 0;         ///< EWMA of the demand slope, per second
+    std::chrono::steady_clock::time_point last_sample_;
+    bool over_ = false;        ///< Active count is above the release threshold
+    std::chrono::steady_clock::time_point over_since_;
+    std::atomic<size_t> restore_below_ { 1 };
+    std::atomic<size_t> release_above_ { std::numeric_limits<size_t>::max() };
+    std::atomic<bool> release_token_ { false }; ///< One release has been granted
+    std::atomic<int64_t> next_sample_ { 0 };    ///< Earliest next sample, in steady_clock ticks
+};
+
+#if defined(__cpp_concepts)
+/// Requirements on the Policy parameter of AdaptiveResourcePool.
+/// Heap policies create resources as unique_ptrs, inline policies (see
+/// InlineFunctionPoolPolicy) construct them in place.
+template<typename P, typename T>
+concept AdaptivePoolPolicy = requires(const P& p, size_t n) {
+    { p.canRestore(n) } -> std::convertible_to<bool>;
+    { p.shouldRelease(n) } -> std::convertible_to<bool>;
+} && (kPolicyStoresInline<P>
+          ? requires(const P& p, size_t n, T* where, T& res) {
+                { p.construct(where, n) } -> std::convertible_to<bool>;
+                p.release(res);
+            }
+          : requires(const P& p, size_t n, std::unique_ptr<T>& res) {
+                { p.initialize() } -> std::convertible_to<std::vector<std::unique_ptr<T>>>;
+                { p.restore(n) } -> std::convertible_to<std::unique_ptr<T>>;
+                p.release(res);
+            });
+#endif
+
+/// AdaptiveResourcePool manages a pool of reusable resources (e.g., connections, buffers).
+/// It can release unused resources and restore them later based on provided strategies,
+/// given as a Policy (see FunctionPoolPolicy and InlineFunctionPoolPolicy).
+template<typename T, typename Policy = FunctionPoolPolicy<T>>
+class AdaptiveResourcePool {
+#if defined(__cpp_concepts)
+    static_assert(AdaptivePoolPolicy<Policy, T>, "Policy does not model AdaptivePoolPolicy");
+#endif
+
+public:
+    /// Pool configuration. It derives from Policy, so the callbacks of the
+    /// default FunctionPoolPolicy are set as Params fields.
+    struct Params: Policy {
+        /// Optional logging function, passed the formatted event text.
+        /// Messages are only formatted when it is set.
+        std::function<void(const std::string&)> logger;
+
+        /// Optional structured logging function, passed each event unformatted.
+        std::function<void(const PoolLogRecord&)> event_logger;
+
+        /// Runtime log threshold. Events below it reach neither logger.
+        PoolLogLevel log_level = PoolLogLevel::Info;
+
+        /// Optional receiver of trace events, e.g. a bridge to Perfetto or
+        /// LTTng. Only called when ADAPTIVE_POOL_ENABLE_TRACING is defined
+        /// before including this header; otherwise tracing compiles to
+        /// nothing. Lock and wait spans are reported with their original
+        /// timestamps once the lock is dropped, so the sink never runs inside
+        /// the pool's critical sections.
+        std::function<void(const PoolTraceEvent&)> trace_sink;
+
+        /// With tracing compiled in, every this-many-th hand-out on each
+        /// thread is sampled with its PoolCallSite for longHolders().
+        /// Zero disables sampling.
+        size_t holder_sample_period = 0;
+
+        /// Optional observer of the pool load, called before restore and release
+        /// decisions: on every acquire() without background maintenance, and
+        /// once per maintenance pass otherwise. HysteresisScalingPolicy uses it.
+        std::function<void(const PoolLoad&)> load_observer;
+
+        /// Period of the background maintenance worker. When non-zero, restore and
+        /// release decisions are taken off the acquire() path: a dedicated thread
+        /// makes them every interval, and as soon as acquire() finds no idle slot.
+        std::chrono::milliseconds maintenance_interval { 0 };
+
+        /// Optional executor for maintenance work, used instead of a dedicated thread.
+        /// It is handed a task whenever acquire() misses or a slot is returned, and
+        /// should run it on another thread. The pool waits for submitted tasks on
+        /// destruction.
+        std::function<void(std::function<void()>)> maintenance_executor;
+
+        /// Maximum number of slots restored per acquire() call or maintenance
+        /// pass. Zero restores every released slot at once.
+        size_t max_restores_per_pass = 0;
+
+        /// Delay before a slot whose restore failed is retried. It doubles with
+        /// every consecutive failure of that slot, up to restore_backoff_max.
+        /// Zero retries on the next pass.
+        std::chrono::milliseconds restore_backoff_initial { 0 };
+
+        /// Upper bound for the per-slot restore backoff.
+        std::chrono::milliseconds restore_backoff_max { 30000 };
+
+        /// Layout of the per-slot state. Padded keeps every slot's state on its
+        /// own cache line, so claiming one slot does not invalidate the line
+        /// other cores use for their neighbours; this pays off with many threads
+        /// on multi-socket machines at the cost of 64 bytes per slot.
+        SlotLayout slot_layout = SlotLayout::Packed;
+
+        /// Number of returned slots each thread may park in a thread-local cache,
+        /// at most kMaxThreadCacheSize. The next acquire from the same thread takes
+        /// a parked slot back without touching shared pool state. Other threads
+        /// steal parked slots once no idle slot is left. A thread caches for up
+        /// to kThreadCachePools pools of the type at once. Zero disables the cache.
+        size_t thread_cache_size = 0;
+
+        /// Minimum number of active resources. Releases requested by should_release
+        /// and trim() never go below it (nor below one).
+        size_t min_size = 0;
+
+        /// Maximum number of active resources. When larger than the initial pool,
+        /// acquire() creates a slot through restore_func whenever none is idle, and
+        /// maintenance passes trim idle slots again once the pool has grown past
+        /// its initial size. Slots live in fixed chunks, so growing never moves
+        /// existing slots or invalidates outstanding resource pointers.
+        /// Zero keeps the pool at the size returned by resource_initializer.
+        size_t max_size = 0;
+
+        /// Idle time after which a resource is released. When non-zero, the pool
+        /// stamps every slot when it is returned and releases slots idle for
+        /// longer than this, least recently used first, down to min_size: in
+        /// maintenance passes, or on release() without background maintenance.
+        /// The victims of should_release are then picked in LRU order as well,
+        /// so recently used (warm) slots stay resident.
+        std::chrono::milliseconds idle_ttl { 0 };
+
+        /// Resources kept for AcquirePriority::High callers. Normal and Low
+        /// acquires are refused (or keep waiting) while taking a resource would
+        /// leave fewer than this many idle or creatable under max_size.
+        size_t reserved_for_high = 0;
+
+        /// Maximum number of resources each class may hold at once, indexed by
+        /// AcquirePriority. Zero is unlimited. An acquire over its class quota
+        /// is refused, or waits until that class releases a resource.
+        std::array<size_t, kAcquirePriorityCount> priority_quota {};
+
+        /// Optional health check, e.g. a ping on a connection. Resources are
+        /// only handed out after passing it; one that fails (or throws) is
+        /// released through release_func and its slot restored on the next
+        /// restore pass, whether or not can_restore allows it. It runs in the
+        /// acquiring caller, never inside release().
+        std::function<bool(T&)> validate;
+
+        /// A resource that passed validate (or was restored) more recently than
+        /// this is handed out without calling validate again. Zero validates
+        /// on every acquire.
+        std::chrono::milliseconds validation_interval { 0 };
+
+        /// Period of background health checks. With background maintenance,
+        /// a maintenance pass this often runs checkHealth(), so stale resources
+        /// are replaced before an acquire finds them. Zero leaves validation
+        /// to acquire and to explicit checkHealth() calls.
+        std::chrono::milliseconds health_check_interval { 0 };
+
+        /// Stamp every hand-out and return of a slot, for the hold and
+        /// last-used times reported by snapshot(). Costs a clock read per
+        /// acquire and per release.
+        bool track_slot_times = false;
+
+        /// How the initial resources are created. Lazy and Parallel modes return
+        /// from the constructor immediately and use restore_func for each of the
+        /// initial_size slots; acquire() hands out each slot as soon as it exists.
+        WarmupMode warmup = WarmupMode::Eager;
+
+        /// Number of initial slots for WarmupMode::Lazy and WarmupMode::Parallel,
+        /// and for WarmupMode::Eager with an inline storage policy.
+        size_t initial_size = 0;
+
+        /// Concurrent restore_func calls for WarmupMode::Parallel. They run on
+        /// maintenance_executor if set, otherwise on dedicated threads.
+        /// Zero uses std::thread::hardware_concurrency().
+        size_t warmup_threads = 0;
+    };
+
+    /// Caller-chosen identity of per-key state cached in a resource, e.g. a
+    /// hashed tenant or model name. See acquire(AffinityKey).
+    using AffinityKey = uint64_t;
+
+    /// Upper bound for Params::thread_cache_size.
+    static constexpr size_t kMaxThreadCacheSize = 8;
+
+    /// Number of pools of this type a thread keeps parked slots for at once.
+    /// Parking for one more pool returns the slots of the least recently
+    /// used one.
+    static constexpr size_t kThreadCachePools = 4;
+
+    /// An acquired resource together with the slot it occupies.
+    /// Passing it back to release() indexes the slot directly. The
+    /// generation identifies this hand-out of the slot, so releasing a handle
+    /// twice, or after the slot was handed to someone else, is rejected.
+    struct Handle {
+        T* resource = nullptr;   ///< Acquired resource, nullptr if acquisition failed
+        size_t index = 0;        ///< Slot index of the resource
+        uint32_t generation = 0; ///< Hand-out of the slot this handle belongs to
+
+        explicit operator bool() const noexcept {
+            return resource != nullptr;
+        }
+
+        T* get() const noexcept {
+            return resource;
+        }
+
+        T* operator->() const noexcept {
+            return resource;
+        }
+    };
+
+    /// Move-only RAII ownership of an acquired resource.
+    /// The slot is returned to the pool when the lease is destroyed or reset.
+    /// It holds the pool pointer and the handle, so returning it costs the
+    /// same as release(const Handle&).
+    class Lease {
+    public:
+        Lease() noexcept = default;
+
+        Lease(Lease&& o) noexcept: pool_(o.pool_), handle_(o.handle_) {
+            o.pool_ = nullptr;
+            o.handle_ = {};
+        }
+
+        Lease& operator=(Lease&& o) noexcept {
+            if (this != &o) {
+                reset();
+                pool_ = o.pool_;
+                handle_ = o.handle_;
+                o.pool_ = nullptr;
+                o.handle_ = {};
+            }
+            return *this;
+        }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        ~Lease() {
+            reset();
+        }
+
+        /// Returns the resource to the pool and leaves the lease empty.
+        void reset() noexcept {
+            if (pool_ != nullptr) {
+                pool_->release(handle_);
+                pool_ = nullptr;
+                handle_ = {};
+            }
+        }
+
+        /// Gives up ownership without returning the resource.
+        /// The caller becomes responsible for releasing the returned handle.
+        Handle detach() noexcept {
+            Handle h = handle_;
+            pool_ = nullptr;
+            handle_ = {};
+            return h;
+        }
+
+        explicit operator bool() const noexcept {
+            return pool_ != nullptr;
+        }
+
+        T* get() const noexcept {
+            return handle_.resource;
+        }
+
+        T& operator*() const noexcept {
+            return *handle_.resource;
+        }
+
+        T* operator->() const noexcept {
+            return handle_.resource;
+        }
+
+        /// Slot index of the leased resource.
+        size_t index() const noexcept {
+            return handle_.index;
+        }
+
+    private:
+        friend class AdaptiveResourcePool;
+
+        Lease(AdaptiveResourcePool* pool, const Handle& handle) noexcept:
+            pool_(pool),
+            handle_(handle) {}
+
+        AdaptiveResourcePool* pool_ = nullptr; ///< Owning pool, nullptr when empty
+        Handle handle_;                        ///< Leased slot
+    };
+
+    /// Constructs the resource pool using the given parameters.
+    explicit AdaptiveResourcePool(const Params& params):
+        params_(params),
+        policy_(std::make_shared<const Policy>(static_cast<const Policy&>(params_))),
+        id_(next_pool_id_.fetch_add(1, std::memory_order_relaxed)) {
+        params_.thread_cache_size = std::min(params_.thread_cache_size, kMaxThreadCacheSize);
+        cache_anchor_ = std::make_shared<CacheAnchor>();
+        cache_anchor_->pool = this;
+        prioritized_ = params_.reserved_for_high != 0
+                       || std::any_of(params_.priority_quota.begin(), params_.priority_quota.end(), [](size_t q) {
+                              return q != 0;
+                          });
+        const bool eager = params_.warmup == WarmupMode::Eager;
+        std::vector<std::unique_ptr<T>> initial;
+        if constexpr (!kInlineStorage) {
+            if (eager) {
+                initial = params_.initialize();
+            }
+        }
+        base_size_ = eager && !kInlineStorage ? initial.size() : params_.initial_size;
+        max_slots_ = std::max(params_.max_size, base_size_);
+        chunk_count_ = (max_slots_ + kChunkSize - 1) / kChunkSize;
+        chunks_ = std::make_unique<std::atomic<Chunk*>[]>(chunk_count_);
+        idle_chunks_ = std::make_unique<std::atomic<uint64_t>[]>(idleChunkWords());
+        cached_chunks_ = std::make_unique<std::atomic<uint64_t>[]>(idleChunkWords());
+        slot_of_.reset(max_slots_);
+        try {
+            populate(initial);
+        } catch (...) {
+            // No destructor runs for a constructor that throws.
+            stopWarmup();
+            stopMaintenance();
+            destroySlots();
+            dropPolicyPins();
+            throw;
+        }
+    }
+
+    /// Cleans up all resources upon destruction.
+    ~AdaptiveResourcePool() {
+        {
+            // Waits for a thread handing slots back; later ones find no pool.
+            std::lock_guard<std::mutex> lk(cache_anchor_->mutex);
+            cache_anchor_->pool = nullptr;
+        }
+        stopWarmup();
+        stopMaintenance();
+        destroySlots();
+        dropPolicyPins();
+        log<PoolEvent::Destroyed>();
+    }
+
+private:
+    /// Constructor body past the chunk directory: fills the eager slots from
+    /// `initial` (or constructs them in place), then starts the warm-up and
+    /// maintenance workers.
+    void populate(std::vector<std::unique_ptr<T>>& initial) {
+        const bool eager = params_.warmup == WarmupMode::Eager;
+        const size_t eager_slots = eager ? base_size_ : 0;
+        size_t filled = 0;
+        for (size_t i = 0; i < eager_slots; ++i) {
+            ensureChunk(i);
+            if constexpr (kInlineStorage) {
+                // A slot that fails to construct stays Released for maybeRecover().
+                if (!createResource(i))
+                    continue;
+            } else {
+                resource(i) = std::move(initial[i]);
+            }
+            slot_of_.insert(resourcePtr(i), i);
+            touch(i);
+            markValidated(i);
+            state(i).store(SlotState::Idle, std::memory_order_relaxed);
+            ++filled;
+        }
+        for (size_t i = 0; i < eager_slots; ++i) {
+            if (state(i).load(std::memory_order_relaxed) == SlotState::Idle) {
+                publish(i, SlotState::Idle);
+            }
+        }
+        slot_count_.store(eager_slots, std::memory_order_release);
+        active_count_.store(filled, std::memory_order_relaxed);
+        idle_count_.store(filled);
+        if (params_.warmup == WarmupMode::Parallel) {
+            startWarmup();
+        }
+        if (params_.maintenance_interval.count() > 0 && !params_.maintenance_executor) {
+            maintenance_thread_ = std::thread([this] { maintenanceLoop(); });
+        }
+    }
+
+    /// Runs release_func for every resource and frees the chunks. Slots
+    /// allocated but never published, e.g. by a constructor that threw, are
+    /// included.
+    void destroySlots() noexcept {
+        for (size_t c = 0; c < chunk_count_; ++c) {
+            if (chunks_[c].load(std::memory_order_relaxed) == nullptr)
+                continue;
+            for (size_t i = c * kChunkSize, end = i + kChunkSize; i < end; ++i) {
+                if (!hasResource(i))
+                    continue;
+                try {
+                    destroyResource(i);
+                } catch (...) {
+                    // Destroyed regardless; the remaining resources still are too.
+                    log<PoolEvent::ReleaseFailed>(i);
+                }
+            }
+        }
+        for (size_t c = 0; c < chunk_count_; ++c) {
+            delete chunks_[c].load(std::memory_order_relaxed);
+        }
+    }
+
+public:
+
+    /// Acquires an available resource.
+    /// Returns nullptr if no resources are currently available.
+    ///
+    /// Idle slots are claimed lock-free with a CAS on their state; the mutex
+    /// is only taken to decide on a restore or release, and the callbacks
+    /// themselves run after it has been dropped.
+    /// As a consequence `can_restore` and `should_release` may be invoked
+    /// concurrently and must be thread-safe.
+    ///
+    /// `priority` is checked against Params::reserved_for_high and
+    /// Params::priority_quota; a resource the caller's class may not take is
+    /// not handed out.
+    T* acquire(AcquirePriority priority = AcquirePriority::Normal) {
+        return acquireHandle(priority).resource;
+    }
+
+    /// Acquires an available resource together with its slot index.
+    /// Returns an empty handle if no resources are currently available.
+    /// Releasing through the handle skips the pointer lookup.
+    Handle acquireHandle(AcquirePriority priority = AcquirePriority::Normal) {
+        const auto start = metrics_.now();
+        return noteAcquired(admit(claimHealthy(), priority), start);
+    }
+
+    /// Acquires an available resource as a Lease that returns it on destruction.
+    /// Returns an empty lease if no resources are currently available.
+    Lease acquireLease(AcquirePriority priority = AcquirePriority::Normal) {
+        Handle h = acquireHandle(priority);
+        if (!h)
+            return {};
+        return Lease(this, h);
+    }
+
+    /// Acquires a resource, preferring an idle slot last acquired with `key`
+    /// so per-key state cached in the resource (prepared statements, loaded
+    /// weights) is reused. Falls back to an idle slot never acquired with a
+    /// key, then to any slot. Key 0 means no preference.
+    /// The pool remembers up to kAffinityWays slots per key hash and finds
+    /// unkeyed slots through a bitmap, so a keyed acquire does not scan the
+    /// pool. Otherwise it behaves like acquire(), running
+    /// the same load tracking, restore and release decisions.
+    /// A release_func call clears the slot's key.
+    T* acquire(AffinityKey key) {
+        return acquireHandle(key).resource;
+    }
+
+    /// Handle variant of acquire(AffinityKey).
+    Handle acquireHandle(AffinityKey key) {
+        if (key == 0)
+            return acquireHandle();
+        const auto start = metrics_.now();
+        Handle h = admit(claimHealthy(key), AcquirePriority::Normal);
+        if (h) {
+            setAffinity(h.index, key);
+            rememberAffine(key, h.index);
+        }
+        return noteAcquired(h, start);
+    }
+
+    /// Lease variant of acquire(AffinityKey).
+    Lease acquireLease(AffinityKey key) {
+        Handle h = acquireHandle(key);
+        if (!h)
+            return {};
+        return Lease(this, h);
+    }
+
+    /// Acquires a resource, blocking up to `timeout` until one is released.
+    /// Returns nullptr if the timeout expires first.
+    template<typename Rep, typename Period>
+    T* acquireFor(
+        const std::chrono::duration<Rep, Period>& timeout,
+        AcquirePriority priority = AcquirePriority::Normal
+    ) {
+        return acquireHandleFor(timeout, priority).resource;
+    }
+
+    /// Acquires a resource, blocking until `deadline` if none is available.
+    /// Returns nullptr if the deadline passes first.
+    template<typename Clock, typename Duration>
+    T* acquireUntil(
+        const std::chrono::time_point<Clock, Duration>& deadline,
+        AcquirePriority priority = AcquirePriority::Normal
+    ) {
+        return acquireHandleUntil(deadline, priority).resource;
+    }
+
+    /// Handle variant of acquireFor().
+    template<typename Rep, typename Period>
+    Handle acquireHandleFor(
+        const std::chrono::duration<Rep, Period>& timeout,
+        AcquirePriority priority = AcquirePriority::Normal
+    ) {
+        return acquireHandleUntil(std::chrono::steady_clock::now() + timeout, priority);
+    }
+
+    /// Handle variant of acquireUntil().
+    /// Blocked callers are queued by priority, FIFO within a class; a returned
+    /// slot is handed directly to the longest-waiting caller of the highest
+    /// class that may take it, and only that caller is woken.
+    template<typename Clock, typename Duration>
+    Handle acquireHandleUntil(
+        const std::chrono::time_point<Clock, Duration>& deadline,
+        AcquirePriority priority = AcquirePriority::Normal
+    ) {
+        const auto start = metrics_.now();
+        if (Handle h = admit(claimHealthy(), priority))
+            return noteAcquired(h, start);
+
+        BlockingWaiter w;
+        w.priority = priority;
+        Handle h;
+        bool waited = false;
+        uint64_t wait_begin = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(wait_mutex_);
+                h = enqueueOrClaim(&w);
+                if (!h) {
+                    if (!waited) {
+                        waited = true;
+                        wait_begin = traceBegin();
+                    }
+                    if (w.cv.wait_until(lk, deadline, [&w] { return w.ready; })) {
+                        h = w.handle;
+                    } else {
+                        dequeueWaiter(&w);
+                    }
+                }
+            }
+            // Whether handed over or claimed by the rescan, the slot is
+            // validated here rather than by the releasing thread.
+            if (!h || healthy(h.index))
+                break;
+            w.ready = false;
+            w.handle = {};
+            replaceForWaiter(h.index);
+            h = {};
+        }
+        if (waited) {
+            traceSpan(PoolTraceSpan::AcquireWait, wait_begin, h ? h.index : PoolLogRecord::kNoSlot, traceId(&w));
+        }
+        return noteAcquired(h, start, waited);
+    }
+
+    /// Lease variant of acquireFor().
+    template<typename Rep, typename Period>
+    Lease acquireLeaseFor(
+        const std::chrono::duration<Rep, Period>& timeout,
+        AcquirePriority priority = AcquirePriority::Normal
+    ) {
+        Handle h = acquireHandleFor(timeout, priority);
+        if (!h)
+            return {};
+        return Lease(this, h);
+    }
+
+    /// Lease variant of acquireUntil().
+    template<typename Clock, typename Duration>
+    Lease acquireLeaseUntil(
+        const std::chrono::time_point<Clock, Duration>& deadline,
+        AcquirePriority priority = AcquirePriority::Normal
+    ) {
+        Handle h = acquireHandleUntil(deadline, priority);
+        if (!h)
+            return {};
+        return Lease(this, h);
+    }
+
+private:
+    /// A caller queued for a slot in the wait queue of its priority class: a
+    /// thread blocked in acquireHandleUntil() or a coroutine suspended in
+    /// asyncAcquire().
+    struct Waiter {
+        Handle handle;       ///< Slot handed over by returnSlot()
+        bool ready = false;  ///< Set together with handle
+        bool queued = false; ///< Linked into the wait queue
+        AcquirePriority priority = AcquirePriority::Normal; ///< Class the waiter is queued and charged in
+        Waiter* prev = nullptr;
+        Waiter* next = nullptr;
+        /// Continues a suspended coroutine once wait_mutex_ has been dropped;
+        /// nullptr for blocked threads.
+        void (*wake)(Waiter*) = nullptr;
+    };
+
+    /// A thread blocked in acquireHandleUntil().
+    struct BlockingWaiter: Waiter {
+        std::condition_variable cv; ///< Signalled once a slot has been handed over
+    };
+
+public:
+#if defined(__cpp_lib_coroutine)
+    /// Resumes a coroutine suspended in asyncAcquire(), e.g. by posting it to
+    /// the executor the coroutine belongs to.
+    using Resumer = std::function<void(std::coroutine_handle<>)>;
+
+    /// Awaitable returned by asyncAcquire(); `co_await` yields a Lease.
+    /// A suspended coroutine waits in the same FIFO queue as blocked threads,
+    /// linked through a node inside the awaiter, so waiting allocates nothing
+    /// and occupies no thread. Destroying a suspended coroutine takes it out
+    /// of the queue.
+    class AcquireAwaiter {
+    public:
+        AcquireAwaiter(const AcquireAwaiter&) = delete;
+        AcquireAwaiter& operator=(const AcquireAwaiter&) = delete;
+
+        ~AcquireAwaiter() {
+            if (!resumed_) {
+                pool_->cancelWaiter(&waiter_);
+            }
+        }
+
+        bool await_ready() {
+            start_ = pool_->metrics_.now();
+            waiter_.handle = pool_->admit(pool_->claimHealthy(), waiter_.priority);
+            return static_cast<bool>(waiter_.handle);
+        }
+
+        /// Queues the coroutine, or continues it at once if a slot turned up.
+        bool await_suspend(std::coroutine_handle<> coroutine) {
+            waiter_.coroutine = coroutine;
+            // Set beforehand: once queued, the coroutine may already be running.
+            waited_ = true;
+            wait_begin_ = pool_->traceBegin();
+            while (!pool_->suspendWaiter(&waiter_)) {
+                // Claimed by the rescan, so not validated yet.
+                if (pool_->healthy(waiter_.handle.index))
+                    return false;
+                pool_->replaceForWaiter(waiter_.handle.index);
+                waiter_.handle = {};
+            }
+            return true;
+        }
+
+        Lease await_resume() noexcept {
+            resumed_ = true;
+            if (waited_) {
+                pool_->traceSpan(PoolTraceSpan::AcquireWait, wait_begin_, waiter_.handle.index, traceId(&waiter_));
+            }
+            return Lease(pool_, pool_->noteAcquired(waiter_.handle, start_, waited_));
+        }
+
+    private:
+        friend class AdaptiveResourcePool;
+
+        /// Wait queue node of a suspended coroutine.
+        struct AsyncWaiter: Waiter {
+            AdaptiveResourcePool* pool = nullptr; ///< Pool waited on
+            std::coroutine_handle<> coroutine;    ///< Coroutine to continue
+            Resumer resumer;                      ///< Optional executor hook
+        };
+
+        AcquireAwaiter(AdaptiveResourcePool* pool, AcquirePriority priority, Resumer resumer): pool_(pool) {
+            waiter_.pool = pool;
+            waiter_.priority = priority;
+            waiter_.resumer = std::move(resumer);
+            waiter_.wake = [](Waiter* w) {
+                auto* aw = static_cast<AsyncWaiter*>(w);
+                if (!aw->pool->acceptHandOff(aw))
+                    return;
+                if (aw->resumer) {
+                    aw->resumer(aw->coroutine);
+                } else {
+                    aw->coroutine.resume();
+                }
+            };
+        }
+
+        AdaptiveResourcePool* pool_;
+        AsyncWaiter waiter_;
+        bool resumed_ = false; ///< await_resume() has taken the slot
+        bool waited_ = false;  ///< The coroutine was queued
+        PoolMetricsRecorder::Stamp start_ {};
+        uint64_t wait_begin_ = 0; ///< Start of the AcquireWait span, if traced
+    };
+
+    /// Acquires a resource from a coroutine: `Lease l = co_await pool.asyncAcquire();`
+    /// Completes immediately if a slot is available, otherwise suspends until
+    /// one is released. The coroutine is then resumed by `resumer`, or inline
+    /// on the releasing thread (inside its release() call) if none is given.
+    AcquireAwaiter asyncAcquire(Resumer resumer = {}) {
+        return asyncAcquire(AcquirePriority::Normal, std::move(resumer));
+    }
+
+    /// asyncAcquire() in the given priority class.
+    AcquireAwaiter asyncAcquire(AcquirePriority priority, Resumer resumer = {}) {
+        return AcquireAwaiter(this, priority, std::move(resumer));
+    }
+#endif
+
+    /// Acquires `k` resources at once, appending their handles to `out`.
+    /// All or nothing: if fewer than `k` can be claimed, every slot claimed so
+    /// far is returned, `out` is left unchanged and false is returned.
+    /// The batch is charged to AcquirePriority::Normal.
+    /// The slots are found through the idle bitmaps without `k` separate
+    /// acquire calls.
+    bool acquireN(size_t k, std::vector<Handle>& out) {
+        if (k == 0)
+            return true;
+        if (!backgroundMaintenance() && wantsRecover()) {
+            maybeRecover();
+        }
+
+        const auto start = metrics_.now();
+        const size_t first = out.size();
+        out.reserve(first + k);
+        while (out.size() - first < k) {
+            Handle h = claimIdle();
+            if (!h)
+                break;
+            if (healthy(h.index)) {
+                out.push_back(h);
+            } else {
+                discardSlot(h.index);
+            }
+        }
+        while (out.size() - first < k) {
+            Handle h = stealCached();
+            if (h && !healthy(h.index)) {
+                discardSlot(h.index);
+                continue;
+            }
+            if (!h) {
+                h = grow();
+            }
+            if (!h)
+                break;
+            out.push_back(h);
+        }
+        if (out.size() - first == k && (!prioritized_ || charge(AcquirePriority::Normal, k))) {
+            for (size_t j = first; j < out.size(); ++j) {
+                holder(out[j].index) = AcquirePriority::Normal;
+                out[j] = noteAcquired(out[j], start);
+            }
+            return true;
+        }
+
+        for (size_t j = first; j < out.size(); ++j) {
+            returnSlot(out[j].index);
+        }
+        out.resize(first);
+        metrics_.onAcquire(start, false);
+        if (backgroundMaintenance()) {
+            requestMaintenance();
+        }
+        return false;
+    }
+
+    /// Releases `count` handles obtained from acquireHandle() or acquireN().
+    void releaseN(const Handle* handles, size_t count) {
+        for (size_t j = 0; j < count; ++j) {
+            const Handle& handle = handles[j];
+            if (!handle || handle.index >= slotCount()) {
+                log<PoolEvent::UnknownRelease>();
+                continue;
+            }
+            if (!retire(handle.index, handle.generation))
+                continue;
+            metrics_.onReturn(acquiredAt(handle.index));
+            discharge(handle.index);
+            touch(handle.index);
+            returnSlot(handle.index);
+        }
+        notifyReturned();
+    }
+
+    /// Releases every handle in `handles`.
+    void releaseN(const std::vector<Handle>& handles) {
+        releaseN(handles.data(), handles.size());
+    }
+
+#if defined(__cpp_lib_span)
+    /// Releases every handle in `handles`.
+    void releaseN(std::span<const Handle> handles) {
+        releaseN(handles.data(), handles.size());
+    }
+#endif
+
+    /// Releases a previously acquired resource back into the pool.
+    /// A pointer whose slot is not held is rejected, but unlike a Handle it
+    /// cannot tell its own hand-out from a later one of the same slot.
+    void release(T* res_ptr) {
+        if (res_ptr != nullptr) {
+            const size_t index = slot_of_.find(res_ptr);
+            if (index != AddressIndex::npos) {
+                if (retire(index, generation(index).load(std::memory_order_relaxed))) {
+                    recycle(index);
+                }
+                return;
+            }
+        }
+        log<PoolEvent::UnknownRelease>();
+    }
+
+    /// Releases a resource acquired through acquireHandle() back into the pool.
+    /// Stale and repeated releases are rejected in O(1) and reported as
+    /// PoolEvent::StaleRelease.
+    void release(const Handle& handle) {
+        if (!handle || handle.index >= slotCount()) {
+            log<PoolEvent::UnknownRelease>();
+            return;
+        }
+        if (retire(handle.index, handle.generation)) {
+            recycle(handle.index);
+        }
+    }
+
+    /// Thread that holds the resource of `handle`, recorded when it was handed
+    /// out. Only tracked with ADAPTIVE_POOL_DEBUG_OWNERSHIP; otherwise, and
+    /// for a handle that is no longer held, a default-constructed id.
+    std::thread::id ownerOf(const Handle& handle) const {
+#if defined(ADAPTIVE_POOL_DEBUG_OWNERSHIP)
+        if (handle && handle.index < slotCount()
+            && state(handle.index).load(std::memory_order_relaxed) == SlotState::Busy
+            && generation(handle.index).load(std::memory_order_relaxed) == handle.generation)
+        {
+            return owner(handle.index).load(std::memory_order_relaxed);
+        }
+#else
+        (void)handle;
+#endif
+        return {};
+    }
+
+    /// Returns the number of idle (available) resources.
+    /// Lock-free and O(1); the result is a snapshot and may be stale immediately.
+    size_t idleCount() const {
+        return idle_count_.load();
+    }
+
+    /// Returns the number of active resources: those that hold, or are being
+    /// restored to hold, a resource.
+    size_t activeCount() const {
+        return active_count_.load(std::memory_order_relaxed);
+    }
+
+    /// Returns the number of slots, whether they hold a resource or not.
+    size_t slotCount() const {
+        return slot_count_.load(std::memory_order_acquire);
+    }
+
+    /// Releases idle resources, including those parked in thread caches,
+    /// until only Params::min_size (at least one) remain active. Returns the
+    /// number of resources released.
+    size_t trim() {
+        size_t released = 0;
+        for (size_t i = slotCount(); i-- > 0;) {
+            if (tryReclaim(i)) {
+                if (!maybeReleaseOne(i)) {
+                    returnSlot(i);
+                    break;
+                }
+                ++released;
+            }
+        }
+        return released;
+    }
+
+    /// Releases resources idle for longer than Params::idle_ttl, least
+    /// recently used first, down to Params::min_size (at least one). Slots
+    /// parked in a thread cache age like idle ones.
+    /// Returns the number of resources released; zero if idle_ttl is not set.
+    size_t evictIdle() {
+        if (!tracksIdleTime())
+            return 0;
+        const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+        const int64_t ttl = std::chrono::duration_cast<std::chrono::steady_clock::duration>(params_.idle_ttl)
+                                .count();
+        std::vector<std::pair<int64_t, size_t>> expired;
+        int64_t oldest_kept = std::numeric_limits<int64_t>::max();
+        for (size_t i = 0, n = slotCount(); i < n; ++i) {
+            const SlotState st = state(i).load(std::memory_order_relaxed);
+            if (st != SlotState::Idle && st != SlotState::Cached)
+                continue;
+            const int64_t used = lastUsed(i).load(std::memory_order_relaxed);
+            if (now - used >= ttl) {
+                expired.emplace_back(used, i);
+            } else {
+                oldest_kept = std::min(oldest_kept, used);
+            }
+        }
+        std::sort(expired.begin(), expired.end());
+
+        size_t released = 0;
+        bool at_floor = false;
+        for (const auto& [used, i]: expired) {
+            if (!tryReclaim(i))
+                continue;
+            // Used and returned since the scan: no longer expired.
+            if (lastUsed(i).load(std::memory_order_relaxed) != used) {
+                returnSlot(i);
+                continue;
+            }
+            if (!maybeReleaseOne(i)) {
+                returnSlot(i);
+                at_floor = true;
+                break;
+            }
+            ++released;
+        }
+        eviction_due_.store(
+            at_floor || oldest_kept == std::numeric_limits<int64_t>::max() ? now + ttl : oldest_kept + ttl,
+            std::memory_order_relaxed
+        );
+        return released;
+    }
+
+    /// Validates every idle resource not validated within
+    /// Params::validation_interval. Those failing are released and their
+    /// slots restored. Returns the number released; zero if validate is not set.
+    /// Runs on the maintenance worker every Params::health_check_interval;
+    /// without background maintenance, call it from your own timer.
+    size_t checkHealth() {
+        if (!params_.validate)
+            return 0;
+        const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+        size_t discarded = 0;
+        for (size_t i = 0, n = slotCount(); i < n; ++i) {
+            if (validationFresh(i, now) || !tryClaim(i))
+                continue;
+            if (healthy(i)) {
+                returnSlot(i);
+            } else {
+                discardSlot(i);
+                ++discarded;
+            }
+        }
+        health_check_due_.store(
+            now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(params_.health_check_interval).count(),
+            std::memory_order_relaxed
+        );
+        return discarded;
+    }
+
+    /// Replaces the policy the pool was constructed with, e.g. the
+    /// can_restore and should_release thresholds of FunctionPoolPolicy, while
+    /// the pool is in use. Acquirers are never blocked: each thread keeps the
+    /// policy it last used and only reloads it once the version changed.
+    /// Calls already running, possibly a slow restore_func, finish on the
+    /// previous policy, which is freed once no thread uses it any more.
+    /// canRestore() and shouldRelease() run on that per-thread copy and must
+    /// not use another pool of the same type.
+    void updatePolicy(Policy policy) {
+        auto next = std::make_shared<const Policy>(std::move(policy));
+#if defined(__cpp_lib_atomic_shared_ptr)
+        policy_.store(std::move(next));
+#else
+        std::atomic_store(&policy_, std::move(next));
+#endif
+        policy_version_.fetch_add(1, std::memory_order_release);
+        if (backgroundMaintenance()) {
+            requestMaintenance();
+        }
+    }
+
+    /// Returns the state of every slot, for finding out where capacity goes.
+    /// Slots are read one by one without locking, so the result is not an
+    /// atomic picture of the pool; a slot changing state meanwhile is
+    /// reported in either state.
+    std::vector<PoolSlotSnapshot> snapshot() const {
+        const auto now = std::chrono::steady_clock::now();
+        const size_t n = slotCount();
+        std::vector<PoolSlotSnapshot> slots(n);
+        for (size_t i = 0; i < n; ++i) {
+            PoolSlotSnapshot& slot = slots[i];
+            slot.index = i;
+            slot.status = slotStatus(state(i).load(std::memory_order_acquire));
+            slot.last_used = std::chrono::steady_clock::time_point(
+                std::chrono::steady_clock::duration(lastUsed(i).load(std::memory_order_relaxed))
+            );
+            const int64_t handed_out = handedOutAt(i).load(std::memory_order_relaxed);
+            if (slot.status == PoolSlotStatus::Busy && handed_out != 0) {
+                const auto since = now.time_since_epoch() - std::chrono::steady_clock::duration(handed_out);
+                slot.held_for = std::max(since, std::chrono::steady_clock::duration::zero());
+            }
+        }
+        return slots;
+    }
+
+    /// Returns the call sites of sampled hand-outs (see
+    /// Params::holder_sample_period), those holding resources longest first.
+    /// Resources still held count with their hold time so far. Empty unless
+    /// ADAPTIVE_POOL_ENABLE_TRACING is defined.
+    std::vector<PoolHolderReport> longHolders() const {
+        std::vector<PoolHolderReport> sites;
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+        {
+            std::lock_guard<std::mutex> lk(holder_mutex_);
+            sites = holder_sites_;
+        }
+        const int64_t now = static_cast<int64_t>(traceNow());
+        for (size_t i = 0, n = slotCount(); i < n; ++i) {
+            const int64_t at = sampledAt(i).load(std::memory_order_relaxed);
+            if (at == 0 || state(i).load(std::memory_order_relaxed) != SlotState::Busy)
+                continue;
+            PoolHolderReport& site = holderSite(sites, sampledSite(i).load(std::memory_order_relaxed));
+            const std::chrono::nanoseconds held(std::max<int64_t>(now - at, 0));
+            ++site.samples;
+            ++site.outstanding;
+            site.total_held += held;
+            site.longest_held = std::max(site.longest_held, held);
+        }
+        std::sort(sites.begin(), sites.end(), [](const PoolHolderReport& a, const PoolHolderReport& b) {
+            return a.longest_held > b.longest_held;
+        });
+#endif
+        return sites;
+    }
+
+    /// Returns the number of resources currently held by callers, including
+    /// slots parked in thread caches.
+    size_t busyCount() const {
+        size_t active = activeCount();
+        size_t unavailable = idleCount() + restoring_count_.load(std::memory_order_relaxed);
+        return active > unavailable ? active - unavailable : 0;
+    }
+
+    /// Returns a snapshot of the pool's counters and latency histograms.
+    /// Collected only when ADAPTIVE_POOL_ENABLE_METRICS is defined before
+    /// including this header; otherwise nothing is measured and every field
+    /// is zero.
+    PoolMetrics metrics() const {
+        return metrics_.snapshot();
+    }
+
+private:
+    /// Lifecycle of a slot. Only Idle slots can be claimed by acquirers;
+    /// every other transition is made by the thread that claimed the slot.
+    enum class SlotState : uint8_t {
+        Idle,      ///< Holds a resource and is free to acquire
+        Busy,      ///< Held by a caller (or being handed over)
+        Releasing, ///< release_func is running, without the pool lock
+        Released,  ///< Holds no resource
+        Restoring, ///< restore_func is running, without the pool lock
+        Cached,    ///< Parked in a thread cache; counted as busy, stealable by anyone
+    };
+
+    struct PolicyPin;
+
+    /// Shared by a pool and the threads caching its slots or pinning its
+    /// policy, so that a thread can hand slots back, and the pool can drop
+    /// pins, without either outliving the other.
+    struct CacheAnchor {
+        std::mutex mutex;                     ///< Held while slots are handed back or pins change
+        AdaptiveResourcePool* pool = nullptr; ///< Cleared by the pool's destructor
+        PolicyPin* pins = nullptr;            ///< Pins of this pool's policy, linked through PolicyPin::next
+    };
+
+    /// Slots the calling thread has parked for the pool identified by pool_id.
+    struct CacheEntry {
+        uint64_t pool_id = 0;                 ///< Owning pool, 0 if unused
+        uint64_t used = 0;                    ///< ThreadCache::clock when last parked into
+        size_t count = 0;                     ///< Number of parked slots
+        size_t slots[kMaxThreadCacheSize] {}; ///< Parked slot indices, most recent last
+        std::weak_ptr<CacheAnchor> anchor;    ///< Owning pool, while it exists
+
+        /// Returns the parked slots to their pool, if it still exists, and
+        /// leaves the entry unused.
+        void flush() {
+            const std::shared_ptr<CacheAnchor> owner = anchor.lock();
+            size_t parked[kMaxThreadCacheSize];
+            const size_t n = count;
+            std::copy(slots, slots + n, parked);
+            // Emptied first: handing slots back may resume a coroutine that
+            // uses this cache.
+            pool_id = 0;
+            count = 0;
+            anchor.reset();
+            if (!owner || n == 0)
+                return;
+            std::lock_guard<std::mutex> lk(owner->mutex);
+            if (owner->pool != nullptr) {
+                owner->pool->unpark(parked, n);
+            }
+        }
+    };
+
+    /// Parked slots of the calling thread for up to kThreadCachePools pools
+    /// of this type, so a thread alternating between a few pools keeps a
+    /// cache for each. They go back to their pools when the thread exits.
+    struct ThreadCache {
+        CacheEntry entries[kThreadCachePools]; ///< One per pool, unused if pool_id is 0
+        uint64_t clock = 0;                    ///< Orders entries by last use
+
+        ThreadCache() = default;
+        ThreadCache(const ThreadCache&) = delete;
+        ThreadCache& operator=(const ThreadCache&) = delete;
+
+        ~ThreadCache() {
+            for (CacheEntry& e: entries) {
+                e.flush();
+            }
+        }
+
+        /// Entry of pool `id`, or nullptr if the thread has none.
+        CacheEntry* find(uint64_t id) noexcept {
+            for (CacheEntry& e: entries) {
+                if (e.pool_id == id)
+                    return &e;
+            }
+            return nullptr;
+        }
+
+        /// Entry of pool `id`. If the thread has none yet, takes an unused
+        /// one, else flushes the least recently used one.
+        CacheEntry& claim(uint64_t id, const std::shared_ptr<CacheAnchor>& anchor) {
+            for (;;) {
+                if (CacheEntry* e = find(id))
+                    return *e;
+                CacheEntry* victim = &entries[0];
+                for (CacheEntry& e: entries) {
+                    // Entries of destroyed pools are reused first.
+                    if (e.pool_id == 0 || e.anchor.expired()) {
+                        e.count = 0;
+                        e.pool_id = id;
+                        e.anchor = anchor;
+                        return e;
+                    }
+                    if (e.used < victim->used) {
+                        victim = &e;
+                    }
+                }
+                // Handing slots back may park slots again, so look once more.
+                victim->flush();
+            }
+        }
+    };
+
+    /// The words every acquire and release of a slot writes, kept together so
+    /// that they share the slot's layout.
+    struct Cell {
+        std::atomic<SlotState> state { SlotState::Released }; ///< Lifecycle state
+        std::atomic<uint32_t> generation { 0 };               ///< Hand-outs retired by release
+    };
+
+    /// Slot cells stored at a fixed stride: adjacent for SlotLayout::Packed,
+    /// one cache line apart for SlotLayout::Padded.
+    class StateArray {
+    public:
+        StateArray() = default;
+        StateArray(const StateArray&) = delete;
+        StateArray& operator=(const StateArray&) = delete;
+
+        ~StateArray() {
+            free();
+        }
+
+        /// Replaces the contents with `count` Released cells in the given layout.
+        void reset(size_t count, SlotLayout layout) {
+            free();
+            stride_ = layout == SlotLayout::Padded ? kAdaptivePoolCacheLineSize : sizeof(Cell);
+            count_ = count;
+            if (count_ == 0)
+                return;
+            base_ = static_cast<unsigned char*>(::operator new(
+                count_ * stride_,
+                std::align_val_t { kAdaptivePoolCacheLineSize }
+            ));
+            for (size_t i = 0; i < count_; ++i) {
+                new (base_ + i * stride_) Cell;
+            }
+        }
+
+        Cell& operator[](size_t i) const noexcept {
+            return *std::launder(reinterpret_cast<Cell*>(base_ + i * stride_));
+        }
+
+        size_t size() const noexcept {
+            return count_;
+        }
+
+    private:
+        void free() noexcept {
+            if (base_ == nullptr)
+                return;
+            for (size_t i = 0; i < count_; ++i) {
+                (*this)[i].~Cell();
+            }
+            ::operator delete(base_, std::align_val_t { kAdaptivePoolCacheLineSize });
+            base_ = nullptr;
+            count_ = 0;
+        }
+
+        unsigned char* base_ = nullptr; ///< Cache-line aligned storage
+        size_t stride_ = 0;             ///< Distance between consecutive cells
+        size_t count_ = 0;              ///< Number of cells
+    };
+
+    /// Lock-free map from resource address to slot index, for release(T*).
+    /// Open addressing over a fixed table of at least twice as many entries
+    /// as the pool has slots, so it never resizes and always has room.
+    /// Entries are only added before a resource is handed out and removed
+    /// once it is being released, so a holder always finds its own.
+    class AddressIndex {
+    public:
+        /// Sizes the table for `slots` resources.
+        void reset(size_t slots) {
+            size_t capacity = 16;
+            while (capacity < 2 * slots) {
+                capacity *= 2;
+            }
+            entries_ = std::make_unique<Entry[]>(capacity);
+            mask_ = capacity - 1;
+        }
+
+        /// Records that `p` is the resource of slot `i`.
+        void insert(const T* p, size_t i) noexcept {
+            const uintptr_t key = reinterpret_cast<uintptr_t>(p);
+            for (size_t k = hash(key);; k = (k + 1) & mask_) {
+                uintptr_t seen = entries_[k].key.load(std::memory_order_relaxed);
+                if ((seen == kEmpty || seen == kErased)
+                    && entries_[k].key.compare_exchange_strong(seen, key, std::memory_order_relaxed))
+                {
+                    entries_[k].slot.store(i + 1, std::memory_order_release);
+                    return;
+                }
+            }
+        }
+
+        /// Forgets `p`, if recorded.
+        void erase(const T* p) noexcept {
+            if (Entry* e = entry(reinterpret_cast<uintptr_t>(p))) {
+                e->slot.store(0, std::memory_order_relaxed);
+                e->key.store(kErased, std::memory_order_release);
+            }
+        }
+
+        /// Slot of resource `p`, or `npos` if `p` is not recorded.
+        size_t find(const T* p) const noexcept {
+            const Entry* e = entry(reinterpret_cast<uintptr_t>(p));
+            const size_t slot = e != nullptr ? e->slot.load(std::memory_order_acquire) : 0;
+            return slot != 0 ? slot - 1 : npos;
+        }
+
+        static constexpr size_t npos = static_cast<size_t>(-1);
+
+    private:
+        static constexpr uintptr_t kEmpty = 0;  ///< Never used; ends a probe
+        static constexpr uintptr_t kErased = 1; ///< Used before; probes go on
+
+        struct Entry {
+            std::atomic<uintptr_t> key { kEmpty }; ///< Resource address, or kEmpty / kErased
+            std::atomic<size_t> slot { 0 };        ///< Slot index + 1, 0 while unset
+        };
+
+        size_t hash(uintptr_t key) const noexcept {
+            // Resource addresses share their low bits; Fibonacci hashing
+            // spreads the rest over the table.
+            return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> 16) & mask_;
+        }
+
+        Entry* entry(uintptr_t key) const noexcept {
+            for (size_t k = hash(key), probes = 0; probes <= mask_; k = (k + 1) & mask_, ++probes) {
+                const uintptr_t seen = entries_[k].key.load(std::memory_order_acquire);
+                if (seen == key)
+                    return &entries_[k];
+                if (seen == kEmpty)
+                    return nullptr;
+            }
+            return nullptr;
+        }
+
+        std::unique_ptr<Entry[]> entries_; ///< Table of mask_ + 1 entries
+        size_t mask_ = 0;
+    };
+
+    /// Policy a thread last read from the pool identified by pool_id, at the
+    /// given policy version. Linked into the pool's anchor while it holds a
+    /// policy, so the pool's destructor can free the policy of every thread.
+    struct PolicyPin {
+        uint64_t pool_id = 0;                 ///< Pool read from, 0 if unused
+        uint64_t version = 0;                 ///< policy_version_ when read
+        uint64_t used = 0;                    ///< PolicyPins::clock when last read
+        std::shared_ptr<const Policy> policy; ///< Kept alive while pinned
+        std::weak_ptr<CacheAnchor> anchor;    ///< Pool read from, while it exists
+        PolicyPin* prev = nullptr;            ///< Neighbours in CacheAnchor::pins
+        PolicyPin* next = nullptr;
+        bool linked = false;                  ///< In CacheAnchor::pins; guarded by its mutex
+
+        /// Unlinks the pin from its pool, if it still exists, and leaves it
+        /// unused.
+        void unpin() noexcept {
+            if (const std::shared_ptr<CacheAnchor> owner = anchor.lock()) {
+                std::lock_guard<std::mutex> lk(owner->mutex);
+                if (linked) {
+                    (prev != nullptr ? prev->next : owner->pins) = next;
+                    if (next != nullptr) {
+                        next->prev = prev;
+                    }
+                    prev = next = nullptr;
+                    linked = false;
+                }
+                policy.reset();
+            }
+            // Without an anchor, the pool's destructor dropped the policy.
+            pool_id = 0;
+            anchor.reset();
+        }
+    };
+
+    /// Policies the calling thread pinned for up to kThreadCachePools pools
+    /// of this type.
+    struct PolicyPins {
+        PolicyPin pins[kThreadCachePools]; ///< One per pool, unused if pool_id is 0
+        uint64_t clock = 0;                ///< Orders pins by last use
+
+        PolicyPins() = default;
+        PolicyPins(const PolicyPins&) = delete;
+        PolicyPins& operator=(const PolicyPins&) = delete;
+
+        ~PolicyPins() {
+            for (PolicyPin& pin: pins) {
+                pin.unpin();
+            }
+        }
+
+        /// Pin of pool `id`, or nullptr if the thread has none.
+        PolicyPin* find(uint64_t id) noexcept {
+            for (PolicyPin& pin: pins) {
+                if (pin.pool_id == id)
+                    return &pin;
+            }
+            return nullptr;
+        }
+
+        /// A pin for pool `id`, linked into `anchor`: an unused one, one of a
+        /// destroyed pool, else the least recently used one.
+        PolicyPin& claim(uint64_t id, const std::shared_ptr<CacheAnchor>& anchor) {
+            PolicyPin* victim = &pins[0];
+            for (PolicyPin& pin: pins) {
+                if (pin.pool_id == 0 || pin.anchor.expired()) {
+                    victim = &pin;
+                    break;
+                }
+                if (pin.used < victim->used) {
+                    victim = &pin;
+                }
+            }
+            victim->unpin();
+            victim->pool_id = id;
+            victim->anchor = anchor;
+            std::lock_guard<std::mutex> lk(anchor->mutex);
+            victim->next = anchor->pins;
+            if (victim->next != nullptr) {
+                victim->next->prev = victim;
+            }
+            anchor->pins = victim;
+            victim->linked = true;
+            return *victim;
+        }
+    };
+
+    /// Restore retry state of a slot. Written only by the thread restoring or
+    /// releasing the slot and read under mutex_ while the slot is Released.
+    struct RestoreBackoff {
+        uint32_t failures = 0;                          ///< Consecutive failed restores
+        bool required = false;                          ///< Restored regardless of can_restore
+        std::chrono::steady_clock::time_point retry_at; ///< Earliest next attempt
+    };
+
+    static constexpr unsigned kAffinityHintBits = 7;
+    static constexpr size_t kAffinityHints = size_t { 1 } << kAffinityHintBits; ///< Entries of affinity_hints_
+    static constexpr size_t kAffinityWays = 4; ///< Slots remembered per affinity_hints_ entry
+
+    static constexpr size_t kChunkShift = 6;
+    static constexpr size_t kChunkSize = size_t { 1 } << kChunkShift; ///< Slots per chunk
+
+    static_assert(kChunkSize == 64, "Chunk::idle_bits and cached_bits hold one bit per slot");
+
+    static constexpr bool kInlineStorage = kPolicyStoresInline<Policy>;
+
+    /// Resources of a chunk, each in its own heap allocation.
+    struct HeapResources {
+        std::unique_ptr<T> owned[kChunkSize]; ///< Managed resources
+
+        T* get(size_t j) const noexcept {
+            return owned[j].get();
+        }
+
+        bool has(size_t j) const noexcept {
+            return owned[j] != nullptr;
+        }
+    };
+
+    /// Resources of a chunk constructed in place in one cache-aligned arena.
+    struct InlineResources {
+        alignas(std::max(alignof(T), kAdaptivePoolCacheLineSize)) unsigned char bytes[kChunkSize * sizeof(T)];
+        bool live[kChunkSize] {}; ///< A resource is constructed at that position
+
+        T* get(size_t j) const noexcept {
+            return std::launder(reinterpret_cast<T*>(const_cast<unsigned char*>(bytes) + j * sizeof(T)));
+        }
+
+        bool has(size_t j) const noexcept {
+            return live[j];
+        }
+    };
+
+    /// A fixed block of slots. Chunks are allocated on demand and never move,
+    /// so slot storage stays valid while the pool grows.
+    struct Chunk {
+        StateArray cells;                        ///< State and generation of each slot
+        std::conditional_t<kInlineStorage, InlineResources, HeapResources> resources; ///< Managed resources
+        RestoreBackoff backoff[kChunkSize];      ///< Restore retry state of each slot
+        PoolMetricsRecorder::Stamp acquired_at[kChunkSize] {}; ///< Last hand-out, for hold times
+        std::atomic<int64_t> last_used[kChunkSize] {}; ///< Last return, in steady_clock ticks
+        std::atomic<int64_t> handed_out_at[kChunkSize] {}; ///< Last hand-out, with track_slot_times
+        std::atomic<AffinityKey> affinity[kChunkSize] {}; ///< Key of the last keyed acquire, 0 if none
+        AcquirePriority holder[kChunkSize] {}; ///< Class the current holder is charged to
+        std::atomic<int64_t> validated_at[kChunkSize] {}; ///< Last passed validation or restore, in steady_clock ticks
+        /// Bit per slot that may be idle; see publish(). On its own cache line,
+        /// as claims and returns write it while the rest of the chunk is
+        /// mostly read.
+        alignas(kAdaptivePoolCacheLineSize) std::atomic<uint64_t> idle_bits { 0 };
+        /// Bit per slot that may be parked in a thread cache.
+        alignas(kAdaptivePoolCacheLineSize) std::atomic<uint64_t> cached_bits { 0 };
+        alignas(kAdaptivePoolCacheLineSize) std::atomic<uint64_t> keyed_bits { 0 }; ///< Bit per slot with a nonzero affinity key
+#if defined(ADAPTIVE_POOL_DEBUG_OWNERSHIP)
+        std::atomic<std::thread::id> owner[kChunkSize] {}; ///< Thread the slot was handed to
+#endif
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+        std::atomic<int64_t> sampled_at[kChunkSize] {};         ///< Sampled hand-out in ns, or zero
+        std::atomic<const char*> sampled_site[kChunkSize] {};   ///< PoolCallSite of that hand-out
+#endif
+    };
+
+    /// Appends `w` to the wait queue of its class. Must be called with
+    /// wait_mutex_ held.
+    void enqueueWaiter(Waiter* w) {
+        const size_t k = static_cast<size_t>(w->priority);
+        w->prev = wait_tail_[k];
+        if (wait_tail_[k] != nullptr) {
+            wait_tail_[k]->next = w;
+        } else {
+            wait_head_[k] = w;
+        }
+        wait_tail_[k] = w;
+        w->queued = true;
+        waiter_count_.fetch_add(1);
+        wait_epoch_.fetch_add(1);
+    }
+
+    /// Unlinks `w` from the wait queue. Must be called with wait_mutex_ held.
+    void dequeueWaiter(Waiter* w) {
+        const size_t k = static_cast<size_t>(w->priority);
+        if (w->prev != nullptr) {
+            w->prev->next = w->next;
+        } else {
+            wait_head_[k] = w->next;
+        }
+        if (w->next != nullptr) {
+            w->next->prev = w->prev;
+        } else {
+            wait_tail_[k] = w->prev;
+        }
+        w->prev = w->next = nullptr;
+        w->queued = false;
+        waiter_count_.fetch_sub(1);
+    }
+
+    /// Queues `w` unless a slot can be claimed for it right away, in which
+    /// case that slot is returned. Must be called with wait_mutex_ held.
+    Handle enqueueOrClaim(Waiter* w) {
+        enqueueWaiter(w);
+        // A slot returned before we were queued would not be handed to us,
+        // unless the waiter's class may not take it anyway.
+        if (prioritized_) {
+            const size_t avail = available();
+            if (avail == 0 || !admits(w->priority, avail - 1))
+                return {};
+        }
+        // Sequentially consistent loads of the bitmaps pair with markIdle()
+        // and parkInThreadCache() publishing before they check for waiters.
+        Handle h = claimIdle(std::memory_order_seq_cst);
+        if (!h) {
+            h = stealCached(std::memory_order_seq_cst);
+        }
+        if (h) {
+            dequeueWaiter(w);
+            assign(h.index, w->priority);
+        }
+        return h;
+    }
+
+    /// Queues a coroutine waiter. Returns false if a slot was claimed for it
+    /// instead, so the coroutine continues without suspending.
+    bool suspendWaiter(Waiter* w) {
+        std::lock_guard<std::mutex> lk(wait_mutex_);
+        w->handle = enqueueOrClaim(w);
+        // w may be resumed and destroyed as soon as the lock is dropped.
+        return !w->handle;
+    }
+
+    /// Takes an abandoned coroutine waiter out of the queue, returning the
+    /// slot if one was already handed to it.
+    void cancelWaiter(Waiter* w) {
+        {
+            std::lock_guard<std::mutex> lk(wait_mutex_);
+            if (w->queued) {
+                dequeueWaiter(w);
+                return;
+            }
+        }
+        if (w->handle) {
+            discharge(w->handle.index);
+            returnSlot(w->handle.index);
+            notifyReturned();
+        }
+    }
+
+    /// Discards the slot `i` a waiter was handed or claimed, whose resource
+    /// failed validation, and gets it replaced: by the maintenance worker if
+    /// there is one, otherwise by restoring it here. The waiter then claims
+    /// or queues again, and takes the replacement like any returned slot.
+    void replaceForWaiter(size_t i) {
+        discharge(i);
+        const auto recover = [this] {
+            if (!backgroundMaintenance() && wantsRecover()) {
+                maybeRecover();
+            }
+        };
+        try {
+            discardSlot(i);
+        } catch (...) {
+            // The slot is Released all the same; its replacement cannot wait.
+            recover();
+            throw;
+        }
+        recover();
+    }
+
+    /// Validates the slot handed to the coroutine waiter `w` before the
+    /// coroutine is continued. One failing validation is replaced and `w`
+    /// queued again; returns false if it is now waiting for the replacement.
+    /// Runs on the releasing thread, so a callback exception is dropped: the
+    /// slot it came from has been put back and the failure logged.
+    bool acceptHandOff(Waiter* w) noexcept {
+        while (!healthy(w->handle.index)) {
+            try {
+                replaceForWaiter(w->handle.index);
+            } catch (...) {
+            }
+            w->ready = false;
+            w->handle = {};
+            if (suspendWaiter(w))
+                return false;
+        }
+        return true;
+    }
+
+    /// Gives the claimed slot `i` to the longest-waiting caller of the highest
+    /// class that may take it, if any. Waiters validate the slot themselves,
+    /// so no user callback runs on the release path.
+    /// Returns false if the caller still holds the slot.
+    bool handOff(size_t i) {
+        Waiter* w = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(wait_mutex_);
+            // Slot i is not counted as available, so handing it over leaves
+            // that count unchanged.
+            const size_t avail = prioritized_ ? available() : 0;
+            for (size_t k = 0; k < kAcquirePriorityCount && w == nullptr; ++k) {
+                Waiter* head = wait_head_[k];
+                if (head != nullptr && (!prioritized_ || admits(head->priority, avail))) {
+                    w = head;
+                }
+            }
+            if (w == nullptr)
+                return false;
+            dequeueWaiter(w);
+            assign(i, w->priority);
+            w->handle = { resourcePtr(i), i };
+            w->ready = true;
+            if (w->wake == nullptr) {
+                // Notified under the lock: the waiter may return and destroy w
+                // as soon as it observes ready.
+                static_cast<BlockingWaiter*>(w)->cv.notify_one();
+                return true;
+            }
+        }
+        // A coroutine is continued without the lock, since it may acquire or
+        // release again straight away. Nothing else touches w once dequeued.
+        w->wake(w);
+        return true;
+    }
+
+    /// Claims any available slot: the thread cache first, then idle slots,
+    /// then parked slots of other threads, then a new slot if the pool may grow.
+    /// With a `key`, idle slots of that key come first and the thread cache
+    /// is only used through stealCached().
+    Handle claimAny(AffinityKey key = 0) {
+        if (key == 0) {
+            if (Handle h = takeFromThreadCache())
+                return h;
+        }
+
+        if (backgroundMaintenance()) {
+            if (Handle h = claimIdleFor(key))
+                return h;
+            requestMaintenance();
+            if (Handle h = stealCached())
+                return h;
+            return grow();
+        }
+
+        observeLoad();
+        if (wantsRecover()) {
+            maybeRecover();
+        }
+
+        if (Handle h = claimIdleFor(key)) {
+            // Check if we should release instead of using it
+            if (policy().shouldRelease(activeCount())) {
+                if (tracksIdleTime()) {
+                    // Keep the caller's slot and give up the coldest one instead.
+                    releaseLeastRecentlyUsed(h.index);
+                } else if (maybeReleaseOne(h.index)) {
+                    return {};
+                }
+            }
+            return h;
+        }
+        if (Handle h = stealCached())
+            return h;
+        return grow();
+    }
+
+    /// claimAny(), discarding claimed resources that fail validation.
+    Handle claimHealthy(AffinityKey key = 0) {
+        for (;;) {
+            Handle h = claimAny(key);
+            if (!h || healthy(h.index))
+                return h;
+            discardSlot(h.index);
+        }
+    }
+
+    /// Claims an idle slot: for a nonzero `key` one remembered for it, or
+    /// else one without a key, before any other.
+    Handle claimIdleFor(AffinityKey key) {
+        if (key != 0) {
+            if (Handle h = claimAffine(key))
+                return h;
+        }
+        return claimIdle();
+    }
+
+    /// Claims an idle slot remembered for `key`, or else an idle slot without
+    /// a key, found by masking the idle bitmap with the keyed one.
+    Handle claimAffine(AffinityKey key) {
+        const size_t n = slotCount();
+        for (const auto& way: affinity_hints_[hintOf(key)]) {
+            const size_t i = way.load(std::memory_order_relaxed);
+            if (i < n && affinity(i).load(std::memory_order_relaxed) == key && tryClaim(i))
+                return { resourcePtr(i), i };
+        }
+        for (size_t w = 0, words = idleChunkWords(); w < words; ++w) {
+            for (uint64_t chunks = idle_chunks_[w].load(std::memory_order_relaxed); chunks != 0;
+                 chunks &= chunks - 1)
+            {
+                const size_t c = w * 64 + countTrailingZeros(chunks);
+                const Chunk& ch = *chunks_[c].load(std::memory_order_acquire);
+                for (uint64_t candidates = ch.idle_bits.load(std::memory_order_relaxed)
+                                           & ~ch.keyed_bits.load(std::memory_order_relaxed);
+                     candidates != 0; candidates &= candidates - 1)
+                {
+                    const size_t i = (c << kChunkShift) + countTrailingZeros(candidates);
+                    if (tryClaim(i))
+                        return { resourcePtr(i), i };
+                }
+            }
+        }
+        return {};
+    }
+
+    /// Sets the key of the claimed slot `i`, keeping its keyed bit in step.
+    void setAffinity(size_t i, AffinityKey key) {
+        if (affinity(i).exchange(key, std::memory_order_relaxed) == key)
+            return;
+        std::atomic<uint64_t>& bits = chunk(i).keyed_bits;
+        const uint64_t bit = uint64_t { 1 } << (i & (kChunkSize - 1));
+        if (key != 0) {
+            bits.fetch_or(bit, std::memory_order_relaxed);
+        } else {
+            bits.fetch_and(~bit, std::memory_order_relaxed);
+        }
+    }
+
+    /// Remembers slot `i`, just acquired with `key`, among the slots of its
+    /// key hash, replacing one that no longer carries the key.
+    void rememberAffine(AffinityKey key, size_t i) {
+        auto& ways = affinity_hints_[hintOf(key)];
+        const size_t n = slotCount();
+        size_t victim = i % kAffinityWays;
+        for (size_t k = 0; k < kAffinityWays; ++k) {
+            const size_t j = ways[k].load(std::memory_order_relaxed);
+            if (j == i)
+                return;
+            if (j >= n || affinity(j).load(std::memory_order_relaxed) != key) {
+                victim = k;
+            }
+        }
+        ways[victim].store(i, std::memory_order_relaxed);
+    }
+
+    static size_t hintOf(AffinityKey key) noexcept {
+        // Fibonacci hashing spreads sequential keys over the table.
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> (64 - kAffinityHintBits));
+    }
+
+    /// Records the acquisition of `h`, started at `start`, and stamps the
+    /// slot for its hold time.
+    Handle noteAcquired(Handle h, PoolMetricsRecorder::Stamp start, bool waited = false) {
+        const auto handed_out = metrics_.onAcquire(start, static_cast<bool>(h), waited);
+        if (h) {
+            acquiredAt(h.index) = handed_out;
+            if (params_.track_slot_times) {
+                handedOutAt(h.index).store(
+                    std::chrono::steady_clock::now().time_since_epoch().count(),
+                    std::memory_order_relaxed
+                );
+            }
+            h.generation = generation(h.index).load(std::memory_order_relaxed);
+#if defined(ADAPTIVE_POOL_DEBUG_OWNERSHIP)
+            owner(h.index).store(std::this_thread::get_id(), std::memory_order_relaxed);
+#endif
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+            trace(PoolTraceSpan::Lease, PoolTracePhase::Begin, traceBegin(), h.index, leaseId(h.index, h.generation));
+            sampleHolder(h.index);
+#endif
+        }
+        return h;
+    }
+
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+    /// Samples every holder_sample_period-th hand-out of the calling thread.
+    void sampleHolder(size_t i) {
+        if (params_.holder_sample_period == 0 || ++holder_sample_tick_ < params_.holder_sample_period)
+            return;
+        holder_sample_tick_ = 0;
+        sampledSite(i).store(PoolCallSite::current(), std::memory_order_relaxed);
+        sampledAt(i).store(static_cast<int64_t>(traceNow()), std::memory_order_relaxed);
+    }
+#endif
+
+    /// Ends the hand-out `gen` of the busy slot `i`, so that no other release
+    /// naming it succeeds. A slot that has moved on to another hand-out, or
+    /// is not held at all, is rejected as a stale release.
+    bool retire(size_t i, uint32_t gen) {
+        // The generation goes first: a retired hand-out has already bumped it,
+        // whatever state the slot has reached since.
+        if (generation(i).load(std::memory_order_relaxed) != gen
+            || state(i).load(std::memory_order_relaxed) != SlotState::Busy
+            || !generation(i).compare_exchange_strong(gen, gen + 1, std::memory_order_relaxed))
+        {
+            log<PoolEvent::StaleRelease>(i);
+            return false;
+        }
+#if defined(ADAPTIVE_POOL_DEBUG_OWNERSHIP)
+        if (owner(i).exchange({}, std::memory_order_relaxed) != std::this_thread::get_id()) {
+            log<PoolEvent::ForeignRelease>(i);
+        }
+#endif
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+        const uint64_t now = traceNow();
+        trace(PoolTraceSpan::Lease, PoolTracePhase::End, now, i, leaseId(i, gen));
+        if (const int64_t at = sampledAt(i).exchange(0, std::memory_order_relaxed); at != 0) {
+            recordHold(sampledSite(i).load(std::memory_order_relaxed), static_cast<int64_t>(now) - at);
+        }
+#endif
+        return true;
+    }
+
+    /// Returns a slot released by a caller: parks it in the thread cache if
+    /// possible, otherwise hands it to a waiter or marks it idle.
+    void recycle(size_t i) {
+        metrics_.onReturn(acquiredAt(i));
+        discharge(i);
+        touch(i);
+        if (!parkInThreadCache(i)) {
+            returnSlot(i);
+        }
+        notifyReturned();
+    }
+
+    /// Parks the claimed slot `i` in the calling thread's cache.
+    bool parkInThreadCache(size_t i) {
+        if (params_.thread_cache_size == 0 || waiter_count_.load(std::memory_order_relaxed) != 0)
+            return false;
+        ThreadCache& table = thread_cache_;
+        CacheEntry& cache = table.claim(id_, cache_anchor_);
+        cache.used = ++table.clock;
+        if (cache.count == params_.thread_cache_size)
+            return false;
+        state(i).store(SlotState::Cached);
+        publish(i, SlotState::Cached);
+        cache.slots[cache.count++] = i;
+        // Same ordering as returnSlot(): a waiter that registered meanwhile
+        // may have missed the parked slot, so hand it over ourselves.
+        if (waiter_count_.load() != 0 && transition(i, SlotState::Cached, SlotState::Busy)) {
+            --cache.count;
+            returnSlot(i);
+        }
+        return true;
+    }
+
+    /// Returns the `count` slots a thread cache parked, unless another thread
+    /// stole them meanwhile.
+    void unpark(const size_t* slots, size_t count) {
+        for (size_t k = 0; k < count; ++k) {
+            if (transition(slots[k], SlotState::Cached, SlotState::Busy)) {
+                returnSlot(slots[k]);
+            }
+        }
+        notifyReturned();
+    }
+
+    /// Takes back the most recently parked slot of the calling thread.
+    Handle takeFromThreadCache() {
+        if (params_.thread_cache_size == 0)
+            return {};
+        CacheEntry* cache = thread_cache_.find(id_);
+        if (cache == nullptr)
+            return {};
+        while (cache->count != 0) {
+            size_t i = cache->slots[--cache->count];
+            // Fails if another thread stole the slot meanwhile.
+            if (transition(i, SlotState::Cached, SlotState::Busy))
+                return { resourcePtr(i), i };
+        }
+        return {};
+    }
+
+    /// Claims a slot parked in some thread's cache. Only used once no idle slot
+    /// is left, so parked slots are never hidden from a starving pool. Goes
+    /// through the parked-slot bitmaps, like claimIdle().
+    Handle stealCached(std::memory_order check = std::memory_order_relaxed) {
+        if (params_.thread_cache_size == 0)
+            return {};
+        return claimMarked(SlotState::Cached, check);
+    }
+
+    /// Returns the claimed slot `i`, handing it to a waiter or marking it idle.
+    void returnSlot(size_t i) {
+        uint64_t epoch = wait_epoch_.load();
+        if (waiter_count_.load() != 0 && handOff(i))
+            return;
+        // Marking the slot idle before checking for waiters again pairs with
+        // acquireHandleUntil() registering before its rescan, so either side
+        // sees the other and the slot cannot be stranded. Only a waiter queued
+        // since the last handOff() can have missed it: those handOff() passed
+        // over are of a class that may not take the slot.
+        markIdle(i);
+        for (uint64_t seen; waiter_count_.load() != 0 && (seen = wait_epoch_.load()) != epoch; epoch = seen) {
+            if (!tryClaim(i) || handOff(i))
+                return;
+            markIdle(i);
+        }
+    }
+
+    /// Resources a Normal or Low caller could still get: idle ones plus those
+    /// max_size still allows to be created.
+    size_t available() const {
+        size_t creatable = 0;
+        if (max_slots_ > base_size_ || slotCount() < base_size_) {
+            const size_t active = activeCount();
+            creatable = active < max_slots_ ? max_slots_ - active : 0;
+        }
+        return idleCount() + creatable;
+    }
+
+    /// Whether class `p` may take one more resource, leaving `available` to
+    /// everyone else.
+    bool admits(AcquirePriority p, size_t available) const {
+        const size_t k = static_cast<size_t>(p);
+        const size_t quota = params_.priority_quota[k];
+        if (quota != 0 && held_[k].load(std::memory_order_relaxed) >= quota)
+            return false;
+        return p == AcquirePriority::High || available >= params_.reserved_for_high;
+    }
 
-    explicit MovableAtomicBool(bool b = false) noexcept: v(b) {}
+    /// Charges `count` just claimed resources to class `p`. Fails, charging
+    /// nothing, if that exceeds the class quota or dipped into the reserve.
+    bool charge(AcquirePriority p, size_t count) {
+        const size_t k = static_cast<size_t>(p);
+        const size_t quota = params_.priority_quota[k];
+        const size_t held = held_[k].fetch_add(count, std::memory_order_relaxed) + count;
+        if ((quota != 0 && held > quota)
+            || (p != AcquirePriority::High && available() < params_.reserved_for_high))
+        {
+            held_[k].fetch_sub(count, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
 
-    bool load(std::memory_order m = std::memory_order_seq_cst) const noexcept {
-        return v.load(m);
+    /// Keeps the claimed `h` for a caller of class `p`, or returns it to the
+    /// pool if the class may not take it.
+    Handle admit(const Handle& h, AcquirePriority p) {
+        if (!h || !prioritized_)
+            return h;
+        if (!charge(p, 1)) {
+            returnSlot(h.index);
+            return {};
+        }
+        holder(h.index) = p;
+        return h;
     }
 
-    void store(bool b, std::memory_order m = std::memory_order_seq_cst) noexcept {
-        v.store(b, m);
+    /// Charges the claimed slot `i` to class `p` unchecked, for slots claimed
+    /// on behalf of a waiter whose class was checked beforehand.
+    void assign(size_t i, AcquirePriority p) {
+        if (prioritized_) {
+            held_[static_cast<size_t>(p)].fetch_add(1, std::memory_order_relaxed);
+            holder(i) = p;
+        }
     }
 
-    bool exchange(bool b, std::memory_order m = std::memory_order_seq_cst) noexcept {
-        return v.exchange(b, m);
+    /// Uncharges the slot `i` its holder is returning.
+    void discharge(size_t i) {
+        if (prioritized_) {
+            held_[static_cast<size_t>(holder(i))].fetch_sub(1, std::memory_order_relaxed);
+        }
     }
 
-    // Move constructor: copies the current value
-    MovableAtomicBool(MovableAtomicBool&& o) noexcept: v(o.v.load(std::memory_order_relaxed)) {}
+    /// Makes the claimed slot `i` available again.
+    void markIdle(size_t i) {
+        // Counted before the store so a racing claim cannot underflow idle_count_.
+        idle_count_.add(1);
+        state(i).store(SlotState::Idle);
+        publish(i, SlotState::Idle);
+    }
 
-    // Move assignment: copies the current value
-    MovableAtomicBool& operator=(MovableAtomicBool&& o) noexcept {
-        v.store(o.v.load(std::memory_order_relaxed), std::memory_order_relaxed);
-        return *this;
+    /// Sets the bits of slot `i` and of its chunk in the bitmaps of `kind`
+    /// (Idle or Cached) after the slot was put in that state. Bits are cleared
+    /// lazily, by claimMarked() finding them stale, so a bit that is set
+    /// already is left alone.
+    void publish(size_t i, SlotState kind) {
+        // Pairs with claimMarkedIn() re-checking the state after clearing a
+        // bit: either it sees the slot in `kind`, or we see the bit cleared.
+        std::atomic<uint64_t>& bits = slotBits(chunk(i), kind);
+        const uint64_t bit = uint64_t { 1 } << (i & (kChunkSize - 1));
+        if ((bits.load() & bit) == 0) {
+            bits.fetch_or(bit);
+        }
+        const size_t c = i >> kChunkShift;
+        std::atomic<uint64_t>& chunks = chunkBits(c / 64, kind);
+        const uint64_t chunk_bit = uint64_t { 1 } << (c % 64);
+        if ((chunks.load() & chunk_bit) == 0) {
+            chunks.fetch_or(chunk_bit);
+        }
     }
 
-    MovableAtomicBool(const MovableAtomicBool&) = delete;
-    MovableAtomicBool& operator=(const MovableAtomicBool&) = delete;
-};
+    /// Claims the lowest idle slot, going through the chunk and slot idle
+    /// bitmaps instead of testing every slot: the cost depends on the number
+    /// of chunks with a bit set rather than on the pool size.
+    Handle claimIdle(std::memory_order check = std::memory_order_relaxed) {
+        return claimMarked(SlotState::Idle, check);
+    }
 
-/// AdaptiveResourcePool manages a pool of reusable resources (e.g., connections, buffers).
-/// It can release unused resources and restore them later based on provided strategies.
-template<typename T>
-class AdaptiveResourcePool {
-public:
-    struct Params {
-        /// Initializes the initial set of resources.
-        std::function<std::vector<std::unique_ptr<T>>()> resource_initializer;
+    /// Claims the lowest slot in state `kind` (Idle or Cached) through the
+    /// bitmaps of that kind. `check` orders the loads of the bitmap words.
+    Handle claimMarked(SlotState kind, std::memory_order check) {
+        for (size_t w = 0, words = idleChunkWords(); w < words; ++w) {
+            for (uint64_t chunks = chunkBits(w, kind).load(check); chunks != 0; chunks &= chunks - 1) {
+                if (Handle h = claimMarkedIn(w * 64 + countTrailingZeros(chunks), kind, check))
+                    return h;
+            }
+        }
+        return {};
+    }
+
+    /// Claims a slot of chunk `c` in state `kind`, clearing the bits found stale.
+    Handle claimMarkedIn(size_t c, SlotState kind, std::memory_order check) {
+        std::atomic<uint64_t>& bits = slotBits(*chunks_[c].load(std::memory_order_acquire), kind);
+        for (uint64_t candidates = bits.load(check); candidates != 0; candidates &= candidates - 1) {
+            const unsigned b = countTrailingZeros(candidates);
+            const size_t i = (c << kChunkShift) + b;
+            if (claimFrom(i, kind))
+                return { resourcePtr(i), i };
+            // Claimed or released since its bit was set: clear it, unless the
+            // slot went back to `kind` meanwhile.
+            bits.fetch_and(~(uint64_t { 1 } << b));
+            if (state(i).load() == kind && claimFrom(i, kind))
+                return { resourcePtr(i), i };
+        }
+        std::atomic<uint64_t>& chunks = chunkBits(c / 64, kind);
+        const uint64_t chunk_bit = uint64_t { 1 } << (c % 64);
+        if (bits.load() == 0) {
+            chunks.fetch_and(~chunk_bit);
+            // A slot published since keeps its chunk visible.
+            if (bits.load() != 0) {
+                chunks.fetch_or(chunk_bit);
+            }
+        }
+        return {};
+    }
+
+    /// Claims slot `i` if it is in state `kind`, Idle or Cached.
+    bool claimFrom(size_t i, SlotState kind) {
+        if (kind == SlotState::Idle)
+            return tryClaim(i);
+        return state(i).load(std::memory_order_relaxed) == SlotState::Cached
+            && transition(i, SlotState::Cached, SlotState::Busy);
+    }
+
+    /// Slot bitmap of chunk `c` for slots in state `kind`.
+    static std::atomic<uint64_t>& slotBits(Chunk& c, SlotState kind) noexcept {
+        return kind == SlotState::Idle ? c.idle_bits : c.cached_bits;
+    }
+
+    /// Word `w` of the chunk bitmap for slots in state `kind`.
+    std::atomic<uint64_t>& chunkBits(size_t w, SlotState kind) const noexcept {
+        return kind == SlotState::Idle ? idle_chunks_[w] : cached_chunks_[w];
+    }
+
+    /// Number of words of the chunk bitmap.
+    size_t idleChunkWords() const noexcept {
+        return (chunk_count_ + 63) / 64;
+    }
+
+    static unsigned countTrailingZeros(uint64_t v) noexcept {
+#if defined(__cpp_lib_bitops)
+        return static_cast<unsigned>(std::countr_zero(v));
+#elif defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_ctzll(v));
+#else
+        unsigned n = 0;
+        for (; (v & 1) == 0; v >>= 1) {
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    Chunk& chunk(size_t i) const noexcept {
+        return *chunks_[i >> kChunkShift].load(std::memory_order_acquire);
+    }
+
+    std::atomic<SlotState>& state(size_t i) const noexcept {
+        return chunk(i).cells[i & (kChunkSize - 1)].state;
+    }
+
+    std::unique_ptr<T>& resource(size_t i) const noexcept {
+        return chunk(i).resources.owned[i & (kChunkSize - 1)];
+    }
+
+    /// Resource of slot `i`. With heap storage it is nullptr if the slot holds
+    /// none; inline storage returns the slot's address either way.
+    T* resourcePtr(size_t i) const noexcept {
+        return chunk(i).resources.get(i & (kChunkSize - 1));
+    }
+
+    bool hasResource(size_t i) const noexcept {
+        return chunk(i).resources.has(i & (kChunkSize - 1));
+    }
+
+    /// Creates the resource of slot `i` through the policy: restore() for heap
+    /// storage, construct() in place for inline storage.
+    bool createResource(size_t i) {
+        if constexpr (kInlineStorage) {
+            auto& resources = chunk(i).resources;
+            const size_t j = i & (kChunkSize - 1);
+            if (!sharedPolicy()->construct(resources.get(j), i))
+                return false;
+            resources.live[j] = true;
+            return true;
+        } else {
+            auto restored = sharedPolicy()->restore(i);
+            if (!restored)
+                return false;
+            resource(i) = std::move(restored);
+            return true;
+        }
+    }
+
+    /// Runs the policy's release() for the resource of slot `i` and destroys
+    /// it. The resource is destroyed even if release() throws.
+    void destroyResource(size_t i) {
+        try {
+            if constexpr (kInlineStorage) {
+                sharedPolicy()->release(*chunk(i).resources.get(i & (kChunkSize - 1)));
+            } else {
+                sharedPolicy()->release(resource(i));
+            }
+        } catch (...) {
+            freeResource(i);
+            throw;
+        }
+        freeResource(i);
+    }
+
+    /// Destroys the resource of slot `i` without calling the policy.
+    void freeResource(size_t i) noexcept {
+        if constexpr (kInlineStorage) {
+            auto& resources = chunk(i).resources;
+            const size_t j = i & (kChunkSize - 1);
+            resources.get(j)->~T();
+            resources.live[j] = false;
+        } else {
+            resource(i).reset();
+        }
+    }
+
+    RestoreBackoff& backoff(size_t i) const noexcept {
+        return chunk(i).backoff[i & (kChunkSize - 1)];
+    }
+
+    PoolMetricsRecorder::Stamp& acquiredAt(size_t i) const noexcept {
+        return chunk(i).acquired_at[i & (kChunkSize - 1)];
+    }
+
+    std::atomic<AffinityKey>& affinity(size_t i) const noexcept {
+        return chunk(i).affinity[i & (kChunkSize - 1)];
+    }
+
+    std::atomic<uint32_t>& generation(size_t i) const noexcept {
+        return chunk(i).cells[i & (kChunkSize - 1)].generation;
+    }
+
+#if defined(ADAPTIVE_POOL_DEBUG_OWNERSHIP)
+    std::atomic<std::thread::id>& owner(size_t i) const noexcept {
+        return chunk(i).owner[i & (kChunkSize - 1)];
+    }
+#endif
+
+    AcquirePriority& holder(size_t i) const noexcept {
+        return chunk(i).holder[i & (kChunkSize - 1)];
+    }
+
+    std::atomic<int64_t>& lastUsed(size_t i) const noexcept {
+        return chunk(i).last_used[i & (kChunkSize - 1)];
+    }
+
+    std::atomic<int64_t>& handedOutAt(size_t i) const noexcept {
+        return chunk(i).handed_out_at[i & (kChunkSize - 1)];
+    }
+
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+    std::atomic<int64_t>& sampledAt(size_t i) const noexcept {
+        return chunk(i).sampled_at[i & (kChunkSize - 1)];
+    }
+
+    std::atomic<const char*>& sampledSite(size_t i) const noexcept {
+        return chunk(i).sampled_site[i & (kChunkSize - 1)];
+    }
+
+    /// Entry of `site` in `sites`, appended if missing.
+    static PoolHolderReport& holderSite(std::vector<PoolHolderReport>& sites, const char* site) {
+        for (PoolHolderReport& r: sites) {
+            if (r.site == site || std::strcmp(r.site, site) == 0)
+                return r;
+        }
+        sites.push_back({});
+        sites.back().site = site;
+        return sites.back();
+    }
+
+    /// Adds a finished sampled hold of `held_ns` to the report of `site`.
+    void recordHold(const char* site, int64_t held_ns) {
+        std::lock_guard<std::mutex> lk(holder_mutex_);
+        PoolHolderReport& r = holderSite(holder_sites_, site);
+        const std::chrono::nanoseconds held(std::max<int64_t>(held_ns, 0));
+        ++r.samples;
+        r.total_held += held;
+        r.longest_held = std::max(r.longest_held, held);
+    }
+#endif
+
+    static uint64_t traceNow() noexcept {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count());
+    }
+
+    /// Reports one event to Params::trace_sink; compiled out without
+    /// ADAPTIVE_POOL_ENABLE_TRACING.
+    void trace(
+        PoolTraceSpan span,
+        PoolTracePhase phase,
+        uint64_t timestamp_ns,
+        size_t index = PoolLogRecord::kNoSlot,
+        uint64_t id = 0
+    ) const {
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+        if (params_.trace_sink) {
+            params_.trace_sink(PoolTraceEvent { span, phase, index, id, timestamp_ns });
+        }
+#else
+        (void)span;
+        (void)phase;
+        (void)timestamp_ns;
+        (void)index;
+        (void)id;
+#endif
+    }
+
+    /// Reports a span that began at `begin_ns`, as returned by traceBegin(),
+    /// and ends now.
+    void traceSpan(PoolTraceSpan span, uint64_t begin_ns, size_t index = PoolLogRecord::kNoSlot, uint64_t id = 0)
+        const {
+        if (begin_ns != 0) {
+            trace(span, PoolTracePhase::Begin, begin_ns, index, id);
+            trace(span, PoolTracePhase::End, traceNow(), index, id);
+        }
+    }
+
+    /// Start of a traced span: the current time, or zero without tracing.
+    uint64_t traceBegin() const noexcept {
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+        if (params_.trace_sink)
+            return traceNow();
+#endif
+        return 0;
+    }
+
+    /// Id pairing the Begin and End of the Lease span of hand-out `gen` of slot `i`.
+    static uint64_t leaseId(size_t i, uint32_t gen) noexcept {
+        return (static_cast<uint64_t>(i) << 32) | gen;
+    }
 
-        /// Determines whether resources should be restored based on active count.
-        std::function<bool(size_t)> can_restore;
+    /// Id pairing the Begin and End of a span tied to the object at `p`.
+    static uint64_t traceId(const void* p) noexcept {
+        return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(p));
+    }
 
-        /// Determines whether resources should be released based on active count.
-        std::function<bool(size_t)> should_release;
+    /// mutex_, locked for the lifetime of the object. With tracing, its wait
+    /// and hold are reported as LockWait and LockHold once it is unlocked.
+    class DecisionLock {
+    public:
+        explicit DecisionLock(const AdaptiveResourcePool& pool): pool_(pool), requested_(pool.traceBegin()) {
+            pool_.mutex_.lock();
+            if (requested_ != 0) {
+                locked_ = traceNow();
+            }
+        }
 
-        /// Restores a resource at the given index.
-        std::function<std::unique_ptr<T>(size_t)> restore_func;
+        ~DecisionLock() {
+            const uint64_t unlocked = requested_ != 0 ? traceNow() : 0;
+            pool_.mutex_.unlock();
+            if (requested_ != 0) {
+                pool_.trace(PoolTraceSpan::LockWait, PoolTracePhase::Begin, requested_);
+                pool_.trace(PoolTraceSpan::LockWait, PoolTracePhase::End, locked_);
+                pool_.trace(PoolTraceSpan::LockHold, PoolTracePhase::Begin, locked_);
+                pool_.trace(PoolTraceSpan::LockHold, PoolTracePhase::End, unlocked);
+            }
+        }
 
-        /// Releases a given resource.
-        std::function<void(std::unique_ptr<T>&)> release_func;
+        DecisionLock(const DecisionLock&) = delete;
+        DecisionLock& operator=(const DecisionLock&) = delete;
 
-        /// Optional logging function.
-        std::function<void(const std::string&)> logger = [](const std::string&) {};
+    private:
+        const AdaptiveResourcePool& pool_;
+        const uint64_t requested_; ///< Time the lock was requested; zero if untraced
+        uint64_t locked_ = 0;
     };
 
-    /// Constructs the resource pool using the given parameters.
-    explicit AdaptiveResourcePool(const Params& params): params_(params) {
-        resources_ = params.resource_initializer();
-        busy_.resize(resources_.size());
-        released_.resize(resources_.size(), false);
+    /// Policy every restore and release decision goes through: the calling
+    /// thread's pinned copy, reloaded after updatePolicy(). A thread keeps a
+    /// pin per pool for up to kThreadCachePools pools, so a hit costs a short
+    /// scan and no reference count. Valid until the thread next reads the
+    /// policy of a pool of this type, so callbacks that may run for long, or
+    /// call into the pool, go through sharedPolicy().
+    const Policy& policy() const {
+        PolicyPins& pins = policy_pins_;
+        const uint64_t version = policy_version_.load(std::memory_order_acquire);
+        PolicyPin* pin = pins.find(id_);
+        if (pin == nullptr || pin->version != version) {
+            if (pin == nullptr) {
+                pin = &pins.claim(id_, cache_anchor_);
+            }
+            pin->policy = sharedPolicy();
+            pin->version = version;
+        }
+        pin->used = ++pins.clock;
+        return *pin->policy;
     }
 
-    /// Cleans up all resources upon destruction.
-    ~AdaptiveResourcePool() {
-        for (size_t i = 0; i < resources_.size(); ++i) {
-            if (!released_[i]) {
-                if (params_.release_func) {
-                    params_.release_func(resources_[i]);
-                }
-                resources_[i].reset();
+    /// The current policy, kept alive by the caller.
+    std::shared_ptr<const Policy> sharedPolicy() const {
+#if defined(__cpp_lib_atomic_shared_ptr)
+        return policy_.load();
+#else
+        return std::atomic_load(&policy_);
+#endif
+    }
+
+    /// Frees the policies other threads still pin for this pool. Called by
+    /// the destructor once no worker can read the policy any more.
+    void dropPolicyPins() noexcept {
+        std::lock_guard<std::mutex> lk(cache_anchor_->mutex);
+        for (PolicyPin* pin = cache_anchor_->pins; pin != nullptr;) {
+            PolicyPin* next = pin->next;
+            pin->policy.reset();
+            pin->prev = pin->next = nullptr;
+            pin->linked = false;
+            pin = next;
+        }
+        cache_anchor_->pins = nullptr;
+    }
+
+    static PoolSlotStatus slotStatus(SlotState s) noexcept {
+        switch (s) {
+        case SlotState::Idle:
+            return PoolSlotStatus::Idle;
+        case SlotState::Busy:
+            return PoolSlotStatus::Busy;
+        case SlotState::Cached:
+            return PoolSlotStatus::Cached;
+        case SlotState::Releasing:
+            return PoolSlotStatus::Releasing;
+        case SlotState::Restoring:
+            return PoolSlotStatus::Restoring;
+        case SlotState::Released:
+            break;
+        }
+        return PoolSlotStatus::Released;
+    }
+
+    std::atomic<int64_t>& validatedAt(size_t i) const noexcept {
+        return chunk(i).validated_at[i & (kChunkSize - 1)];
+    }
+
+    /// Stamps the resource of slot `i` as known good now.
+    void markValidated(size_t i) {
+        if (params_.validate) {
+            validatedAt(i).store(
+                std::chrono::steady_clock::now().time_since_epoch().count(),
+                std::memory_order_relaxed
+            );
+        }
+    }
+
+    /// Whether slot `i` passed validation less than validation_interval before `now`.
+    bool validationFresh(size_t i, int64_t now) const {
+        const int64_t interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                     params_.validation_interval
+        )
+                                     .count();
+        return interval > 0 && now - validatedAt(i).load(std::memory_order_relaxed) < interval;
+    }
+
+    /// Whether the resource in the claimed slot `i` may be handed out: freshly
+    /// validated, or passing validate now.
+    bool healthy(size_t i) {
+        if (!params_.validate)
+            return true;
+        const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+        if (validationFresh(i, now))
+            return true;
+        bool passed = false;
+        try {
+            passed = params_.validate(*resourcePtr(i));
+        } catch (...) {
+            // A check that cannot run says as much about the resource.
+        }
+        if (!passed)
+            return false;
+        validatedAt(i).store(now, std::memory_order_relaxed);
+        return true;
+    }
+
+    /// Whether slots are stamped with their last use for idle_ttl eviction.
+    bool tracksIdleTime() const noexcept {
+        return params_.idle_ttl.count() > 0;
+    }
+
+    /// Stamps slot `i` as used now. Must be called before the slot is
+    /// returned, so internal claims (trim, eviction) do not refresh it.
+    void touch(size_t i) {
+        if (tracksIdleTime() || params_.track_slot_times) {
+            lastUsed(i).store(
+                std::chrono::steady_clock::now().time_since_epoch().count(),
+                std::memory_order_relaxed
+            );
+        }
+    }
+
+    /// Idle slot other than `except` that was returned longest ago, or
+    /// slotCount() if there is none.
+    size_t leastRecentlyUsedIdle(size_t except) const {
+        size_t victim = slotCount();
+        int64_t oldest = std::numeric_limits<int64_t>::max();
+        for (size_t i = 0, n = victim; i < n; ++i) {
+            if (i == except || state(i).load(std::memory_order_relaxed) != SlotState::Idle)
+                continue;
+            const int64_t used = lastUsed(i).load(std::memory_order_relaxed);
+            if (used < oldest) {
+                oldest = used;
+                victim = i;
             }
         }
-        resources_.clear();
-        busy_.clear();
-        released_.clear();
-        params_.logger("AdaptiveResourcePool destroyed.");
+        return victim;
     }
 
-    /// Acquires an available resource.
-    /// Returns nullptr if no resources are currently available.
-    T* acquire() {
-        std::lock_guard<std::mutex> lk(mutex_);
-        maybeRecover();
+    /// Releases the coldest idle slot other than `except`, if the floor allows.
+    bool releaseLeastRecentlyUsed(size_t except) {
+        const size_t victim = leastRecentlyUsedIdle(except);
+        if (victim == slotCount() || !tryClaim(victim))
+            return false;
+        if (!maybeReleaseOne(victim)) {
+            returnSlot(victim);
+            return false;
+        }
+        return true;
+    }
+
+    /// Allocates the chunk holding slot `i` if needed.
+    /// Called from the constructor or with mutex_ held.
+    void ensureChunk(size_t i) {
+        auto& entry = chunks_[i >> kChunkShift];
+        if (entry.load(std::memory_order_relaxed) != nullptr)
+            return;
+        auto c = std::make_unique<Chunk>();
+        c->cells.reset(kChunkSize, params_.slot_layout);
+        entry.store(c.release(), std::memory_order_release);
+    }
 
-        for (size_t i = 0; i < resources_.size(); ++i) {
-            if (!busy_[i].load() && !released_[i]) {
-                // Check if we should release instead of using it
-                if (params_.should_release && params_.should_release(activeCount())) {
-                    maybeReleaseOne(i);
+    /// Creates a resource for the caller when no slot is idle, either in a
+    /// released slot or in a new one, as long as max_size allows.
+    /// Lazily warmed pools use the same path to create their initial slots.
+    Handle grow() {
+        if (max_slots_ <= base_size_ && slotCount() >= base_size_)
+            return {};
+        size_t i = 0;
+        {
+            DecisionLock lk(*this);
+            if (activeCount() >= max_slots_)
+                return {};
+            const auto now = std::chrono::steady_clock::now();
+            const size_t n = slotCount();
+            for (i = 0; i < n; ++i) {
+                if (state(i).load(std::memory_order_acquire) == SlotState::Released
+                    && (backoff(i).failures == 0 || backoff(i).retry_at <= now)
+                    && transition(i, SlotState::Released, SlotState::Restoring))
+                {
                     break;
                 }
-                busy_[i].store(true);
-                return resources_[i].get();
             }
+            if (i == n) {
+                if (n == max_slots_)
+                    return {};
+                ensureChunk(i);
+                state(i).store(SlotState::Restoring, std::memory_order_relaxed);
+                if (i < base_size_) {
+                    // An initial slot of a lazy pool: retried until it exists.
+                    requireRestore(i);
+                }
+                slot_count_.store(n + 1, std::memory_order_release);
+            }
+            active_count_.fetch_add(1, std::memory_order_relaxed);
+            restoring_count_.fetch_add(1, std::memory_order_relaxed);
         }
-        return nullptr;
+        if (!restoreResource(i))
+            return {};
+        return { resourcePtr(i), i };
     }
 
-    /// Releases a previously acquired resource back into the pool.
-    void release(T* res_ptr) {
-        std::lock_guard<std::mutex> lk(mutex_);
-        for (size_t i = 0; i < resources_.size(); ++i) {
-            if (resources_[i].get() == res_ptr) {
-                busy_[i].store(false);
+    /// Moves slot `i` from `from` to `to`, failing if it is in any other state.
+    bool transition(size_t i, SlotState from, SlotState to) {
+        return state(i).compare_exchange_strong(from, to, std::memory_order_acq_rel);
+    }
+
+    /// Claims slot `i` if it is idle.
+    bool tryClaim(size_t i, std::memory_order check = std::memory_order_relaxed) {
+        if (state(i).load(check) != SlotState::Idle)
+            return false;
+        SlotState expected = SlotState::Idle;
+        if (!state(i).compare_exchange_strong(expected, SlotState::Busy, std::memory_order_acquire))
+            return false;
+        idle_count_.add(-1);
+        return true;
+    }
+
+    /// Claims slot `i` if it is idle or parked in a thread cache, for trim()
+    /// and evictIdle(). The thread that parked it finds it gone.
+    bool tryReclaim(size_t i) {
+        return tryClaim(i) || claimFrom(i, SlotState::Cached);
+    }
+
+    /// Lock-free pre-check deciding whether acquire() has to enter maybeRecover().
+    bool wantsRecover() const {
+        size_t active = activeCount();
+        if (active >= slotCount())
+            return false;
+        if (required_restores_.load(std::memory_order_relaxed) == 0 && !policy().canRestore(active))
+            return false;
+        auto hold = restore_hold_until_.load(std::memory_order_relaxed);
+        return hold == 0 || std::chrono::steady_clock::now().time_since_epoch().count() >= hold;
+    }
+
+    /// Attempts to restore released resources if allowed.
+    /// The slots are claimed as Restoring under mutex_ and restored after
+    /// it has been dropped, so other slots stay acquirable meanwhile.
+    /// At most max_restores_per_pass slots are claimed, skipping slots that
+    /// are still backing off from a failed restore. Slots that must come back
+    /// (see requireRestore()) are restored whatever can_restore says.
+    void maybeRecover() {
+        std::vector<size_t> claimed;
+        {
+            DecisionLock lk(*this);
+            bool allowed = policy().canRestore(activeCount());
+            if (!allowed && required_restores_.load(std::memory_order_relaxed) == 0)
                 return;
+
+            const auto now = std::chrono::steady_clock::now();
+            auto next_retry = std::chrono::steady_clock::time_point::max();
+            size_t allowed_claims = 0;
+            bool refused = false; // A released slot was skipped for can_restore
+            for (size_t i = 0, n = slotCount(); i < n; ++i) {
+                if (params_.max_restores_per_pass != 0
+                    && claimed.size() >= params_.max_restores_per_pass)
+                {
+                    break;
+                }
+                if (state(i).load(std::memory_order_acquire) != SlotState::Released)
+                    continue;
+                const bool required = backoff(i).required;
+                if (!required && !allowed) {
+                    refused = true;
+                    continue;
+                }
+                if (backoff(i).failures != 0 && backoff(i).retry_at > now) {
+                    next_retry = std::min(next_retry, backoff(i).retry_at);
+                    continue;
+                }
+                // Asked again for each further slot, so a target is not overshot.
+                if (!required && allowed_claims != 0 && !(allowed = policy().canRestore(activeCount()))) {
+                    refused = true;
+                    continue;
+                }
+                if (transition(i, SlotState::Released, SlotState::Restoring)) {
+                    active_count_.fetch_add(1, std::memory_order_relaxed);
+                    restoring_count_.fetch_add(1, std::memory_order_relaxed);
+                    claimed.push_back(i);
+                    allowed_claims += required ? 0 : 1;
+                }
+            }
+            // Keep acquire() from taking the lock again while every released
+            // slot is backing off.
+            restore_hold_until_.store(
+                claimed.empty() && !refused && next_retry != std::chrono::steady_clock::time_point::max()
+                    ? next_retry.time_since_epoch().count()
+                    : 0,
+                std::memory_order_relaxed
+            );
+        }
+
+        for (size_t k = 0; k < claimed.size(); ++k) {
+            try {
+                restoreSlot(claimed[k]);
+            } catch (...) {
+                // Slots not attempted yet go back to Released as they were.
+                for (size_t j = k + 1; j < claimed.size(); ++j) {
+                    restoring_count_.fetch_sub(1, std::memory_order_relaxed);
+                    active_count_.fetch_sub(1, std::memory_order_relaxed);
+                    state(claimed[j]).store(SlotState::Released, std::memory_order_release);
+                }
+                throw;
             }
         }
-        params_.logger("Tried to release unknown resource.");
     }
 
-    /// Returns the number of idle (available) resources.
-    size_t idleCount() const {
-        std::lock_guard<std::mutex> lk(mutex_);
-        size_t count = 0;
-        for (size_t i = 0; i < resources_.size(); ++i) {
-            if (!busy_[i].load() && !released_[i]) {
-                ++count;
+    /// Runs restore_func for slot `i`, which must be in the Restoring state,
+    /// and makes the restored slot available.
+    void restoreSlot(size_t i) {
+        if (restoreResource(i)) {
+            touch(i);
+            returnSlot(i);
+        }
+    }
+
+    /// Runs restore_func for slot `i`, which must be in the Restoring state.
+    /// On success the slot stays claimed by the caller; on failure it is
+    /// Released again and backs off. An exception from restore_func counts as
+    /// a failure and is rethrown once the slot has been put back.
+    bool restoreResource(size_t i) {
+        const auto start = metrics_.now();
+        const uint64_t traced = traceBegin();
+        bool restored = false;
+        try {
+            restored = createResource(i);
+        } catch (...) {
+            metrics_.onRestore(start, false);
+            traceSpan(PoolTraceSpan::Restore, traced, i);
+            failRestore(i);
+            throw;
+        }
+        metrics_.onRestore(start, restored);
+        traceSpan(PoolTraceSpan::Restore, traced, i);
+        if (!restored) {
+            failRestore(i);
+            return false;
+        }
+        restoring_count_.fetch_sub(1, std::memory_order_relaxed);
+        backoff(i).failures = 0;
+        if (backoff(i).required) {
+            backoff(i).required = false;
+            required_restores_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        markValidated(i);
+        // Owned by the caller now, exactly like a claimed slot.
+        state(i).store(SlotState::Busy, std::memory_order_relaxed);
+        slot_of_.insert(resourcePtr(i), i);
+        log<PoolEvent::Restored>(i);
+        return true;
+    }
+
+    /// Reports `E` to the configured loggers. Events below
+    /// kAdaptivePoolMinLogLevel compile to nothing; the message text is only
+    /// built when Params::logger is set.
+    template<PoolEvent E>
+    void log(size_t index = PoolLogRecord::kNoSlot) const {
+        constexpr PoolLogLevel level = poolEventLevel(E);
+        if constexpr (level >= kAdaptivePoolMinLogLevel) {
+            if (level < params_.log_level || (!params_.event_logger && !params_.logger))
+                return;
+            const PoolLogRecord record { E, level, index };
+            if (params_.event_logger) {
+                params_.event_logger(record);
+            }
+            if (params_.logger) {
+                params_.logger(formatPoolEvent(record));
             }
+        } else {
+            (void)index;
         }
-        return count;
     }
 
-private:
-    /// Counts the number of active (non-released) resources.
-    size_t activeCount() const {
-        return std::count(released_.begin(), released_.end(), false);
+    /// Marks the slot `i`, claimed by the caller, to be restored by the next
+    /// maybeRecover() even if can_restore declines: it was not released by
+    /// the scaling policy (it failed validation, or is an initial slot being
+    /// warmed up), so the pool would otherwise stay short of it.
+    void requireRestore(size_t i) {
+        if (!backoff(i).required) {
+            backoff(i).required = true;
+            required_restores_.fetch_add(1, std::memory_order_relaxed);
+        }
     }
 
-    /// Attempts to restore released resources if allowed.
-    void maybeRecover() {
-        size_t active = activeCount();
-        if (!params_.can_restore || !params_.can_restore(active))
+    /// Returns the Restoring slot `i`, whose restore failed, to Released and
+    /// backs it off.
+    void failRestore(size_t i) {
+        restoring_count_.fetch_sub(1, std::memory_order_relaxed);
+        scheduleRetry(i);
+        active_count_.fetch_sub(1, std::memory_order_relaxed);
+        state(i).store(SlotState::Released, std::memory_order_release);
+        log<PoolEvent::RestoreFailed>(i);
+    }
+
+    /// Backs slot `i` off exponentially after a failed restore.
+    void scheduleRetry(size_t i) {
+        RestoreBackoff& b = backoff(i);
+        auto delay = params_.restore_backoff_initial;
+        for (uint32_t n = 0; n < b.failures && delay < params_.restore_backoff_max; ++n) {
+            delay *= 2;
+        }
+        delay = std::min(delay, params_.restore_backoff_max);
+        ++b.failures;
+        b.retry_at = std::chrono::steady_clock::now() + delay;
+    }
+
+    /// Releases the slot `index`, which the caller has already claimed.
+    /// Returns false (and keeps the slot claimed) if that would leave fewer
+    /// than Params::min_size, or no, active resources.
+    /// The decision is made under mutex_; release_func runs without it.
+    bool maybeReleaseOne(size_t index) {
+        {
+            DecisionLock lk(*this);
+            if (activeCount() <= std::max<size_t>(params_.min_size, 1))
+                return false;
+            state(index).store(SlotState::Releasing, std::memory_order_relaxed);
+            active_count_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        releaseResource(index);
+        log<PoolEvent::Released>(index);
+        return true;
+    }
+
+    /// Releases the claimed slot `index` whose resource failed validation,
+    /// whatever min_size says, and schedules its restore, whatever
+    /// can_restore says.
+    void discardSlot(size_t index) {
+        log<PoolEvent::Invalidated>(index);
+        {
+            DecisionLock lk(*this);
+            state(index).store(SlotState::Releasing, std::memory_order_relaxed);
+            active_count_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        requireRestore(index);
+        releaseResource(index);
+        if (backgroundMaintenance()) {
+            requestMaintenance();
+        }
+    }
+
+    /// Runs release_func for slot `index`, which must be Releasing and no
+    /// longer counted as active, and leaves it Released. An exception from
+    /// release_func is rethrown once the resource is destroyed and the slot
+    /// Released; it can be restored like any other.
+    void releaseResource(size_t index) {
+        slot_of_.erase(resourcePtr(index));
+        // A rebuilt resource starts without per-key state.
+        setAffinity(index, 0);
+        const auto start = metrics_.now();
+        const uint64_t traced = traceBegin();
+        try {
+            destroyResource(index);
+        } catch (...) {
+            finishRelease(index, start, traced);
+            log<PoolEvent::ReleaseFailed>(index);
+            throw;
+        }
+        finishRelease(index, start, traced);
+    }
+
+    /// Leaves the slot `index`, whose resource has been destroyed, Released.
+    void finishRelease(size_t index, PoolMetricsRecorder::Stamp start, uint64_t traced) {
+        metrics_.onRelease(start);
+        traceSpan(PoolTraceSpan::Release, traced, index);
+        state(index).store(SlotState::Released, std::memory_order_release);
+        // A freshly released slot is not backing off.
+        restore_hold_until_.store(0, std::memory_order_relaxed);
+    }
+
+    /// Reports the current load to Params::load_observer, if set.
+    void observeLoad() {
+        if (params_.load_observer) {
+            params_.load_observer(
+                { activeCount(), busyCount(), idleCount(), waiter_count_.load(std::memory_order_relaxed) }
+            );
+        }
+    }
+
+    /// Whether restore and release decisions are left to maintenance work.
+    bool backgroundMaintenance() const {
+        return params_.maintenance_interval.count() > 0 || params_.maintenance_executor;
+    }
+
+    /// One maintenance pass: run checkHealth() when due, restore if allowed,
+    /// then release one idle slot if should_release asks for it or the pool
+    /// has grown past its initial size with more than one slot idle.
+    /// Grown pools are trimmed from the highest index down, or in LRU order
+    /// when idle_ttl is set; expired idle slots are evicted first.
+    void runMaintenance() {
+        observeLoad();
+        if (params_.health_check_interval.count() > 0
+            && std::chrono::steady_clock::now().time_since_epoch().count()
+                   >= health_check_due_.load(std::memory_order_relaxed))
+        {
+            checkHealth();
+        }
+        if (wantsRecover()) {
+            maybeRecover();
+        }
+        evictIdle();
+        // One spare idle slot is kept so steady load does not grow and trim in turns.
+        bool trim_grown = activeCount() > base_size_ && idleCount() > 1;
+        if (!trim_grown && !policy().shouldRelease(activeCount()))
             return;
+        if (tracksIdleTime()) {
+            releaseLeastRecentlyUsed(slotCount());
+            return;
+        }
+        for (size_t i = slotCount(); i-- > 0;) {
+            if (!tryClaim(i))
+                continue;
+            if (!maybeReleaseOne(i)) {
+                returnSlot(i);
+            }
+            return;
+        }
+    }
 
-        for (size_t i = 0; i < resources_.size(); ++i) {
-            if (released_[i]) {
-                auto restored = params_.restore_func(i);
-                if (restored) {
-                    resources_[i] = std::move(restored);
-                    released_[i] = false;
-                    busy_[i].store(false);
-                    params_.logger("Restored resource[" + std::to_string(i) + "]");
-                } else {
-                    params_.logger("Failed to restore resource[" + std::to_string(i) + "]");
+    /// Lets an executor re-evaluate the release policy after a slot came back.
+    /// The dedicated thread relies on its interval for that instead.
+    /// Runs on the release path, which must not throw: a Lease returns its
+    /// slot from a noexcept destructor. A release_func that throws while
+    /// evicting has already left its slot Released and been reported as
+    /// PoolEvent::ReleaseFailed, so the exception is dropped here, as on the
+    /// maintenance worker; the remaining expired slots go on the next return.
+    void notifyReturned() noexcept {
+        try {
+            if (params_.maintenance_executor) {
+                requestMaintenance();
+            } else if (tracksIdleTime() && !backgroundMaintenance()
+                       && std::chrono::steady_clock::now().time_since_epoch().count()
+                              >= eviction_due_.load(std::memory_order_relaxed))
+            {
+                evictIdle();
+            }
+        } catch (...) {
+        }
+    }
+
+    /// Schedules a maintenance pass; requests made while one is pending coalesce.
+    void requestMaintenance() {
+        if (maintenance_pending_.load(std::memory_order_relaxed)
+            || maintenance_pending_.exchange(true))
+            return;
+        std::unique_lock<std::mutex> lk(maintenance_mutex_);
+        if (maintenance_stopping_) {
+            return;
+        }
+        if (!params_.maintenance_executor) {
+            maintenance_cv_.notify_one();
+            return;
+        }
+        ++maintenance_tasks_;
+        lk.unlock();
+        try {
+            params_.maintenance_executor([this] {
+                maintenance_pending_.store(false);
+                runMaintenanceSafely();
+                std::lock_guard<std::mutex> task_lk(maintenance_mutex_);
+                if (--maintenance_tasks_ == 0) {
+                    maintenance_cv_.notify_all();
                 }
+            });
+        } catch (...) {
+            // The task was not taken: let the destructor and later requests go on.
+            lk.lock();
+            if (--maintenance_tasks_ == 0) {
+                maintenance_cv_.notify_all();
             }
+            maintenance_pending_.store(false);
+            throw;
         }
     }
 
-    /// Releases one idle resource starting from the given index.
-    void maybeReleaseOne(size_t start_index) {
-        size_t active = activeCount();
-        for (size_t i = start_index; i < resources_.size(); ++i) {
-            if (!busy_[i].load() && !released_[i]) {
-                if (active <= 1)
-                    break;
-                busy_[i].store(true);
-                params_.release_func(resources_[i]);
-                resources_[i].reset();
-                released_[i] = true;
-                params_.logger("Released resource[" + std::to_string(i) + "]");
+    /// runMaintenance() on a worker, where a callback exception has nowhere to
+    /// go. The slot it came from has been put back and the failure logged.
+    void runMaintenanceSafely() noexcept {
+        try {
+            runMaintenance();
+        } catch (...) {
+        }
+    }
+
+    /// Body of the dedicated maintenance thread.
+    void maintenanceLoop() {
+        std::unique_lock<std::mutex> lk(maintenance_mutex_);
+        while (!maintenance_stopping_) {
+            maintenance_cv_.wait_for(lk, params_.maintenance_interval, [this] {
+                return maintenance_stopping_ || maintenance_pending_.load();
+            });
+            if (maintenance_stopping_)
                 break;
+            maintenance_pending_.store(false);
+            lk.unlock();
+            runMaintenanceSafely();
+            lk.lock();
+        }
+    }
+
+    /// Publishes the initial slots as Restoring and creates them in the
+    /// background. Each restored slot is handed out (or to a waiter) at once;
+    /// one whose restore fails backs off and is retried by maybeRecover().
+    void startWarmup() {
+        for (size_t i = 0; i < base_size_; ++i) {
+            ensureChunk(i);
+            state(i).store(SlotState::Restoring, std::memory_order_relaxed);
+            requireRestore(i);
+        }
+        active_count_.store(base_size_, std::memory_order_relaxed);
+        restoring_count_.store(base_size_, std::memory_order_relaxed);
+        slot_count_.store(base_size_, std::memory_order_release);
+
+        size_t workers = params_.warmup_threads;
+        if (workers == 0) {
+            workers = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        }
+        workers = std::min(workers, base_size_);
+        for (size_t w = 0; w < workers; ++w) {
+            if (params_.maintenance_executor) {
+                {
+                    std::lock_guard<std::mutex> lk(maintenance_mutex_);
+                    ++maintenance_tasks_;
+                }
+                params_.maintenance_executor([this] {
+                    warmupWorker();
+                    std::lock_guard<std::mutex> task_lk(maintenance_mutex_);
+                    if (--maintenance_tasks_ == 0) {
+                        maintenance_cv_.notify_all();
+                    }
+                });
+            } else {
+                warmup_threads_.emplace_back([this] { warmupWorker(); });
+            }
+        }
+    }
+
+    /// Restores initial slots until none is left to pick.
+    void warmupWorker() {
+        for (;;) {
+            size_t i = warmup_next_.fetch_add(1, std::memory_order_relaxed);
+            if (i >= base_size_)
+                return;
+            try {
+                restoreSlot(i);
+            } catch (...) {
+                // Released and logged like a failed restore; carry on with the rest.
             }
         }
     }
 
+    /// Stops handing out warm-up work and waits for the dedicated warm-up threads.
+    void stopWarmup() {
+        warmup_next_.store(base_size_, std::memory_order_relaxed);
+        for (auto& t: warmup_threads_) {
+            t.join();
+        }
+        warmup_threads_.clear();
+    }
+
+    /// Stops the maintenance thread and waits for outstanding executor tasks.
+    void stopMaintenance() {
+        {
+            std::unique_lock<std::mutex> lk(maintenance_mutex_);
+            maintenance_stopping_ = true;
+            maintenance_cv_.notify_all();
+            maintenance_cv_.wait(lk, [this] { return maintenance_tasks_ == 0; });
+        }
+        if (maintenance_thread_.joinable()) {
+            maintenance_thread_.join();
+        }
+    }
+
 private:
-    Params params_;                           ///< Pool configuration parameters
-    std::vector<std::unique_ptr<T>> resources_; ///< Managed resources
-    std::vector<MovableAtomicBool> busy_;     ///< Busy flags for each resource
-    std::vector<bool> released_;              ///< Release state flags
-    mutable std::mutex mutex_;                ///< Synchronization mutex
+    static inline std::atomic<uint64_t> next_pool_id_ { 1 }; ///< Source of pool ids
+    static inline thread_local ThreadCache thread_cache_;      ///< Calling thread's parked slots, per pool
+    static inline thread_local PolicyPins policy_pins_;        ///< Calling thread's last read policies, per pool
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+    static inline thread_local size_t holder_sample_tick_ = 0; ///< Hand-outs since the last sample
+#endif
+
+    Params params_;                                ///< Pool configuration parameters
+#if defined(__cpp_lib_atomic_shared_ptr)
+    std::atomic<std::shared_ptr<const Policy>> policy_; ///< Current policy
+#else
+    std::shared_ptr<const Policy> policy_;         ///< Current policy; only accessed through std::atomic_load and std::atomic_store
+#endif
+    std::atomic<uint64_t> policy_version_ { 0 };   ///< Bumped by updatePolicy() after policy_ changed
+    const uint64_t id_;                            ///< Unique id, tags thread cache entries
+    std::shared_ptr<CacheAnchor> cache_anchor_;    ///< Lets thread caches return slots and pins be dropped
+    std::unique_ptr<std::atomic<Chunk*>[]> chunks_; ///< Chunk directory, sized for max_slots_
+    std::unique_ptr<std::atomic<uint64_t>[]> idle_chunks_; ///< Bit per chunk that may hold an idle slot
+    std::unique_ptr<std::atomic<uint64_t>[]> cached_chunks_; ///< Bit per chunk that may hold a parked slot
+    size_t chunk_count_ = 0;                       ///< Length of the chunk directory
+    size_t base_size_ = 0;                         ///< Initial pool size; trimming stops here
+    size_t max_slots_ = 0;                         ///< Upper bound for slot_count_
+    std::atomic<size_t> slot_count_ { 0 };         ///< Slots published to scanners
+
+    // Written on every acquire and return, so kept apart from everything else.
+    StripedCounter idle_count_; ///< Slots in the Idle state, striped since every claim and return updates it
+
+    // Read on the hot paths, written only on restore, release and waiting.
+    alignas(kAdaptivePoolCacheLineSize) std::atomic<size_t> active_count_ { 0 }; ///< Slots holding or restoring a resource
+    std::atomic<size_t> restoring_count_ { 0 };    ///< Slots in the Restoring state
+    std::atomic<size_t> required_restores_ { 0 };  ///< Released slots marked by requireRestore()
+    std::atomic<size_t> waiter_count_ { 0 };       ///< Number of queued waiters
+    std::atomic<uint64_t> wait_epoch_ { 0 };       ///< Bumped by every enqueue
+    std::atomic<int64_t> restore_hold_until_ { 0 }; ///< No restore is due before this steady_clock tick
+    std::atomic<int64_t> eviction_due_ { 0 };       ///< No idle slot expires before this steady_clock tick
+    std::atomic<int64_t> health_check_due_ { 0 };   ///< Next background checkHealth(), in steady_clock ticks
+
+    // Written on every acquire and return once priorities are configured.
+    alignas(kAdaptivePoolCacheLineSize) std::atomic<size_t> held_[kAcquirePriorityCount] {}; ///< Resources held per class
+    bool prioritized_ = false; ///< reserved_for_high or a priority_quota is set
+
+    alignas(kAdaptivePoolCacheLineSize) std::atomic<size_t> affinity_hints_[kAffinityHints][kAffinityWays] {}; ///< Recent slots per key hash
+
+    AddressIndex slot_of_; ///< Resource pointer to slot index
+
+    alignas(kAdaptivePoolCacheLineSize) mutable std::mutex mutex_; ///< Serializes restore and release decisions
+    std::mutex wait_mutex_;                        ///< Guards the wait queue
+    Waiter* wait_head_[kAcquirePriorityCount] {};  ///< Longest-waiting caller per class
+    Waiter* wait_tail_[kAcquirePriorityCount] {};  ///< Most recent waiter per class
+    std::mutex maintenance_mutex_;                 ///< Guards the maintenance state below
+    std::condition_variable maintenance_cv_;       ///< Wakes the worker, signals task completion
+    bool maintenance_stopping_ = false;            ///< Set once destruction has begun
+    size_t maintenance_tasks_ = 0;                 ///< Executor tasks not yet finished
+    std::atomic<bool> maintenance_pending_ { false }; ///< A maintenance pass has been requested
+    std::thread maintenance_thread_;               ///< Dedicated worker, if any
+    std::atomic<size_t> warmup_next_ { 0 };        ///< Next initial slot to create in parallel
+    std::vector<std::thread> warmup_threads_;      ///< Dedicated warm-up workers, if any
+#if defined(ADAPTIVE_POOL_ENABLE_TRACING)
+    mutable std::mutex holder_mutex_;              ///< Guards holder_sites_
+    std::vector<PoolHolderReport> holder_sites_;   ///< Released sampled hand-outs per call site
+#endif
+    PoolMetricsRecorder metrics_; ///< Statistics; empty unless metrics are enabled
 };
+
+} // inline namespace ADAPTIVE_POOL_ABI_NAMESPACE
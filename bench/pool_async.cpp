@@ -0,0 +1,252 @@
+// Coroutine harness for asyncAcquire(). Walks the awaiter through each of its
+// paths on a single thread, then has many threads acquire from coroutines
+// while others release, and checks that every slot came back.
+//
+// Usage: pool_async [threads] [seconds]
+// Needs C++20. Exits non-zero if a check failed. Meant to be run under
+// -fsanitize=thread as well as in optimised builds.
+
+#include "../adaptive_resource_pool.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+
+#if !defined(__cpp_lib_coroutine)
+#error "pool_async needs C++20 coroutines"
+#endif
+
+namespace {
+
+struct Resource {
+    size_t id;
+    std::atomic<int> holders { 0 }; ///< Concurrent owners; must never exceed one
+};
+
+using Pool = AdaptiveResourcePool<Resource>;
+
+static_assert(AdaptivePoolPolicy<FunctionPoolPolicy<Resource>, Resource>);
+
+std::atomic<bool> g_failed { false };
+
+void fail(const char* what) {
+    if (!g_failed.exchange(true)) {
+        std::fprintf(stderr, "check failed: %s\n", what);
+    }
+}
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        fail(what);
+    }
+}
+
+void use(Resource* res) {
+    if (res->holders.fetch_add(1) != 0) {
+        fail("resource held by two callers");
+    }
+    res->holders.fetch_sub(1);
+}
+
+/// Eagerly started coroutine whose frame is destroyed with the Task. `done`
+/// is set once the body has finished, from whichever thread resumed it.
+struct Task {
+    struct promise_type {
+        std::atomic<bool> done { false };
+
+        Task get_return_object() {
+            return Task { std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        /// Suspends for good, then publishes completion: the frame may be
+        /// destroyed as soon as `done` is seen.
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                h.promise().done.store(true, std::memory_order_release);
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> h): handle(h) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        handle.destroy();
+    }
+
+    bool done() const {
+        return handle.promise().done.load(std::memory_order_acquire);
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+/// Acquires one resource, records which slot it got, and holds it until the
+/// coroutine finishes.
+Task acquireOne(Pool& pool, size_t& got, Pool::Resumer resumer = {}) {
+    Pool::Lease lease = co_await pool.asyncAcquire(std::move(resumer));
+    check(static_cast<bool>(lease), "co_await yielded an empty lease");
+    got = lease.index();
+    use(lease.get());
+}
+
+Pool::Params makeParams(size_t size) {
+    Pool::Params params;
+    params.resource_initializer = [size]() {
+        std::vector<std::unique_ptr<Resource>> res;
+        for (size_t i = 0; i < size; ++i) {
+            auto r = std::make_unique<Resource>();
+            r->id = i;
+            res.push_back(std::move(r));
+        }
+        return res;
+    };
+    params.release_func = [](std::unique_ptr<Resource>&) {};
+    return params;
+}
+
+/// Each path of the awaiter on a one-slot pool.
+void checkPaths() {
+    constexpr size_t kNone = static_cast<size_t>(-1);
+    Pool pool(makeParams(1));
+
+    // Immediate completion: a slot is idle, so the coroutine never suspends.
+    {
+        size_t got = kNone;
+        Task t = acquireOne(pool, got);
+        check(t.done() && got == 0, "idle slot not taken without suspending");
+    }
+    check(pool.idleCount() == 1, "lease of an immediate acquire not returned");
+
+    // Suspend, then hand-off: release() resumes the coroutine inline.
+    {
+        Pool::Handle held = pool.acquireHandle();
+        size_t got = kNone;
+        Task t = acquireOne(pool, got);
+        check(!t.done(), "coroutine did not suspend on a busy pool");
+        pool.release(held);
+        check(t.done() && got == held.index, "release did not hand the slot over");
+    }
+    check(pool.idleCount() == 1, "hand-off leaked a slot");
+
+    // Resumer: the hand-off is posted instead of resumed inline.
+    {
+        std::deque<std::coroutine_handle<>> posted;
+        Pool::Handle held = pool.acquireHandle();
+        size_t got = kNone;
+        Task t = acquireOne(pool, got, [&](std::coroutine_handle<> h) { posted.push_back(h); });
+        pool.release(held);
+        check(!t.done() && posted.size() == 1, "resumer not used for the hand-off");
+        check(pool.busyCount() == 1, "posted slot not reserved for the coroutine");
+        posted.front().resume();
+        check(t.done() && got == held.index, "posted coroutine did not get the slot");
+    }
+    check(pool.idleCount() == 1, "resumed acquire leaked a slot");
+
+    // Destroying a queued coroutine takes it out of the wait queue.
+    {
+        Pool::Handle held = pool.acquireHandle();
+        size_t got = kNone;
+        {
+            Task t = acquireOne(pool, got);
+        }
+        pool.release(held);
+        check(got == kNone && pool.idleCount() == 1, "slot handed to a destroyed coroutine");
+    }
+
+    // Destroying a coroutine whose slot was posted but never resumed returns it.
+    {
+        std::deque<std::coroutine_handle<>> posted;
+        Pool::Handle held = pool.acquireHandle();
+        size_t got = kNone;
+        {
+            Task t = acquireOne(pool, got, [&](std::coroutine_handle<> h) { posted.push_back(h); });
+            pool.release(held);
+            check(posted.size() == 1, "resumer not used for the hand-off");
+        }
+        check(got == kNone && pool.idleCount() == 1, "posted slot lost with its coroutine");
+    }
+
+    // The std::span overload of releaseN.
+    {
+        Pool::Handle batch[1] = { pool.acquireHandle() };
+        pool.releaseN(std::span<const Pool::Handle>(batch));
+        check(pool.idleCount() == 1, "span releaseN did not return the slot");
+    }
+}
+
+/// Coroutines on `threads` threads contend for a few slots with blocking
+/// callers; every coroutine must finish and every slot come back.
+uint64_t checkConcurrent(size_t threads, long seconds) {
+    constexpr size_t kSize = 4;
+    Pool pool(makeParams(kSize));
+    std::atomic<bool> stop { false };
+    std::atomic<uint64_t> ops { 0 };
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::minstd_rand rng(static_cast<unsigned>(t + 1));
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (rng() % 2 == 0) {
+                    size_t got = 0;
+                    Task task = acquireOne(pool, got);
+                    while (!task.done()) {
+                        std::this_thread::yield();
+                    }
+                } else if (auto lease = pool.acquireLeaseFor(std::chrono::milliseconds(5))) {
+                    use(lease.get());
+                    std::this_thread::yield();
+                }
+                ops.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto& w: workers) {
+        w.join();
+    }
+    check(pool.busyCount() == 0 && pool.idleCount() == kSize, "slots missing after the run");
+    return ops.load();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const size_t threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8;
+    const long seconds = argc > 2 ? std::strtol(argv[2], nullptr, 10) : 2;
+
+    checkPaths();
+    const uint64_t ops = checkConcurrent(threads, seconds);
+
+    std::printf(
+        "%llu async operations on %zu threads in %lds: %s\n",
+        static_cast<unsigned long long>(ops),
+        threads,
+        seconds,
+        g_failed ? "FAILED" : "ok"
+    );
+    return g_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,301 @@
+// Throughput and latency of acquire/release across thread counts, pool sizes
+// and hold times, plus a churn scenario that keeps the restore and release
+// paths busy.
+//
+// Build with CMake (-DADAPTIVE_POOL_BUILD_BENCHMARKS=ON, the default), or:
+//   g++ -O2 -std=c++17 -I.. pool_bench.cpp -lbenchmark -lpthread -o pool_bench
+
+#include "../adaptive_resource_pool.hpp"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+struct Buffer {
+    size_t id;
+};
+
+using Pool = AdaptiveResourcePool<Buffer>;
+
+/// How a benchmark thread takes and returns its resource.
+enum class Path {
+    Pointer,     ///< acquire() / release(T*): pointer lookup under a shared lock
+    Handle,      ///< acquireHandle() / release(Handle): direct slot index
+    ThreadCache, ///< Handle path with thread_cache_size = 4
+    Blocking,    ///< acquireHandleFor(): FIFO wait when no slot is idle
+};
+
+/// Inline policy that restores everything and never releases, so every
+/// acquire() also goes through the can_restore check.
+struct StaticPolicy {
+    size_t size = 0;
+
+    std::vector<std::unique_ptr<Buffer>> initialize() const {
+        std::vector<std::unique_ptr<Buffer>> res;
+        for (size_t i = 0; i < size; ++i) {
+            res.push_back(std::make_unique<Buffer>(Buffer { i }));
+        }
+        return res;
+    }
+
+    bool canRestore(size_t) const {
+        return true;
+    }
+
+    bool shouldRelease(size_t) const {
+        return false;
+    }
+
+    std::unique_ptr<Buffer> restore(size_t index) const {
+        return std::make_unique<Buffer>(Buffer { index });
+    }
+
+    void release(std::unique_ptr<Buffer>&) const {}
+};
+
+using PolicyPool = AdaptiveResourcePool<Buffer, StaticPolicy>;
+using InlinePool = AdaptiveResourcePool<Buffer, InlineFunctionPoolPolicy<Buffer>>;
+
+std::unique_ptr<Pool> g_pool;
+std::unique_ptr<PolicyPool> g_policy_pool;
+std::unique_ptr<InlinePool> g_inline_pool;
+std::unique_ptr<PoolLatencyHistogram> g_histogram;
+
+Pool::Params makeParams(size_t size) {
+    Pool::Params params;
+    params.resource_initializer = [size]() {
+        std::vector<std::unique_ptr<Buffer>> res;
+        for (size_t i = 0; i < size; ++i) {
+            res.push_back(std::make_unique<Buffer>(Buffer { i }));
+        }
+        return res;
+    };
+    params.restore_func = [](size_t index) {
+        return std::make_unique<Buffer>(Buffer { index });
+    };
+    params.release_func = [](std::unique_ptr<Buffer>&) {};
+    params.can_restore = [](size_t) { return true; };
+    params.should_release = [](size_t) { return false; };
+    return params;
+}
+
+/// Keeps the resource for about `ns` nanoseconds.
+void hold(int64_t ns) {
+    if (ns <= 0)
+        return;
+    const auto until = std::chrono::steady_clock::now() + std::chrono::nanoseconds(ns);
+    while (std::chrono::steady_clock::now() < until) {
+        benchmark::ClobberMemory();
+    }
+}
+
+/// range(0): pool size, range(1): hold time in nanoseconds.
+void BM_AcquireRelease(benchmark::State& state, Path path) {
+    if (state.thread_index() == 0) {
+        auto params = makeParams(static_cast<size_t>(state.range(0)));
+        if (path == Path::ThreadCache) {
+            params.thread_cache_size = 4;
+        }
+        g_pool = std::make_unique<Pool>(params);
+    }
+    const int64_t hold_ns = state.range(1);
+    int64_t misses = 0;
+    for (auto _: state) {
+        switch (path) {
+        case Path::Pointer:
+            if (Buffer* res = g_pool->acquire()) {
+                hold(hold_ns);
+                g_pool->release(res);
+            } else {
+                ++misses;
+            }
+            break;
+        case Path::Handle:
+        case Path::ThreadCache:
+            if (auto h = g_pool->acquireHandle()) {
+                hold(hold_ns);
+                g_pool->release(h);
+            } else {
+                ++misses;
+            }
+            break;
+        case Path::Blocking:
+            if (auto h = g_pool->acquireHandleFor(std::chrono::milliseconds(100))) {
+                hold(hold_ns);
+                g_pool->release(h);
+            } else {
+                ++misses;
+            }
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["misses"] = static_cast<double>(misses);
+    if (state.thread_index() == 0) {
+        g_pool.reset();
+    }
+}
+
+/// Handle path through a compile-time policy instead of std::function callbacks.
+void BM_AcquireReleasePolicy(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        PolicyPool::Params params;
+        params.size = static_cast<size_t>(state.range(0));
+        g_policy_pool = std::make_unique<PolicyPool>(params);
+    }
+    const int64_t hold_ns = state.range(1);
+    for (auto _: state) {
+        if (auto h = g_policy_pool->acquireHandle()) {
+            hold(hold_ns);
+            g_policy_pool->release(h);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        g_policy_pool.reset();
+    }
+}
+
+/// BM_Churn with resources constructed in place (InlineFunctionPoolPolicy),
+/// so restores and releases do not allocate. range(0): pool size.
+void BM_ChurnInline(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        const size_t size = static_cast<size_t>(state.range(0));
+        InlinePool::Params params;
+        params.initial_size = size;
+        params.construct_func = [](Buffer* where, size_t index) {
+            ::new (where) Buffer { index };
+            return true;
+        };
+        params.can_restore = [size](size_t active) { return active < size; };
+        params.should_release = [size](size_t active) { return active > size / 2; };
+        g_inline_pool = std::make_unique<InlinePool>(params);
+    }
+    int64_t misses = 0;
+    for (auto _: state) {
+        if (auto h = g_inline_pool->acquireHandle()) {
+            g_inline_pool->release(h);
+        } else {
+            ++misses;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["misses"] = static_cast<double>(misses);
+    if (state.thread_index() == 0) {
+        g_inline_pool.reset();
+    }
+}
+
+/// Per-operation latency of an acquire/release pair, reported as p50/p99/p999
+/// counters in nanoseconds. range(0): pool size.
+void BM_AcquireLatency(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        g_histogram = std::make_unique<PoolLatencyHistogram>();
+        g_pool = std::make_unique<Pool>(makeParams(static_cast<size_t>(state.range(0))));
+    }
+    for (auto _: state) {
+        const auto start = std::chrono::steady_clock::now();
+        if (auto h = g_pool->acquireHandle()) {
+            g_pool->release(h);
+        }
+        g_histogram->record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+                .count()
+        ));
+    }
+    if (state.thread_index() == 0) {
+        g_pool.reset();
+        const auto snap = g_histogram->snapshot();
+        g_histogram.reset();
+        state.counters["p50_ns"] = static_cast<double>(snap.percentile(0.5));
+        state.counters["p99_ns"] = static_cast<double>(snap.percentile(0.99));
+        state.counters["p999_ns"] = static_cast<double>(snap.percentile(0.999));
+    }
+}
+
+/// Acquire/release with every slot but the highest one held, so an acquire
+/// that scanned the pool would walk it end to end. Single-threaded.
+/// range(0): pool size.
+void BM_AcquireFragmented(benchmark::State& state) {
+    const size_t size = static_cast<size_t>(state.range(0));
+    Pool pool(makeParams(size));
+    std::vector<Pool::Handle> held;
+    for (size_t i = 0; i < size; ++i) {
+        held.push_back(pool.acquireHandle());
+    }
+    pool.release(held.back());
+    held.pop_back();
+    for (auto _: state) {
+        auto h = pool.acquireHandle();
+        benchmark::DoNotOptimize(h);
+        pool.release(h);
+    }
+    state.SetItemsProcessed(state.iterations());
+    pool.releaseN(held);
+}
+
+/// Policies that flap around `range(0) / 2` active resources, so acquire()
+/// keeps entering maybeRecover() and maybeReleaseOne(). range(1) is the cost
+/// of restore_func in nanoseconds.
+void BM_Churn(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        const size_t size = static_cast<size_t>(state.range(0));
+        const int64_t restore_ns = state.range(1);
+        auto params = makeParams(size);
+        params.restore_func = [restore_ns](size_t index) {
+            hold(restore_ns);
+            return std::make_unique<Buffer>(Buffer { index });
+        };
+        params.can_restore = [size](size_t active) { return active < size; };
+        params.should_release = [size](size_t active) { return active > size / 2; };
+        g_pool = std::make_unique<Pool>(params);
+    }
+    int64_t misses = 0;
+    for (auto _: state) {
+        if (auto h = g_pool->acquireHandle()) {
+            g_pool->release(h);
+        } else {
+            ++misses;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["misses"] = static_cast<double>(misses);
+    if (state.thread_index() == 0) {
+        g_pool.reset();
+    }
+}
+
+void poolShapes(benchmark::internal::Benchmark* b) {
+    b->ArgNames({ "size", "hold_ns" });
+    for (int64_t size: { 1, 8, 64 }) {
+        for (int64_t hold_ns: { 0, 1000 }) {
+            b->Args({ size, hold_ns });
+        }
+    }
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(BM_AcquireRelease, pointer, Path::Pointer)->Apply(poolShapes)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_CAPTURE(BM_AcquireRelease, handle, Path::Handle)->Apply(poolShapes)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK_CAPTURE(BM_AcquireRelease, thread_cache, Path::ThreadCache)
+    ->Apply(poolShapes)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_AcquireRelease, blocking, Path::Blocking)
+    ->Apply(poolShapes)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK(BM_AcquireReleasePolicy)->Apply(poolShapes)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_AcquireLatency)->ArgName("size")->Arg(8)->Arg(64)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_ChurnInline)->ArgName("size")->Arg(8)->Arg(64)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_AcquireFragmented)->ArgName("size")->Arg(8)->Arg(64)->Arg(1024)->Arg(16384);
+BENCHMARK(BM_Churn)
+    ->ArgNames({ "size", "restore_ns" })
+    ->Args({ 8, 0 })
+    ->Args({ 8, 10000 })
+    ->Args({ 64, 0 })
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
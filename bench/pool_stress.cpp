@@ -0,0 +1,560 @@
+// Contention stress harness. Hammers one pool from many threads with every
+// acquire flavour while flapping policies keep restoring and releasing slots,
+// then checks that no resource was ever held twice and every counter settled.
+// Built as C++20, coroutines awaiting asyncAcquire() join the mix.
+//
+// The mixed run is followed by one short run per feature, each asserting the
+// worst case that feature promises.
+//
+// Usage: pool_stress [threads] [seconds] [pool size]
+// `seconds` is the length of the mixed run; each feature run takes a tenth of
+// it, at least 100 ms. Exits non-zero if an invariant was violated. Meant to
+// be run under -fsanitize=thread as well as in optimised builds.
+
+#include "../adaptive_resource_pool.hpp"
+#include "../sharded_adaptive_resource_pool.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+struct Resource {
+    explicit Resource(size_t i): id(i) {
+        live.fetch_add(1);
+    }
+
+    ~Resource() {
+        live.fetch_sub(1);
+    }
+
+    size_t id;
+    std::atomic<int> holders { 0 };     ///< Concurrent owners; must never exceed one
+    std::atomic<bool> broken { false }; ///< Fails validation once set
+
+    static inline std::atomic<long> live { 0 }; ///< Resources not yet destroyed
+};
+
+using Pool = AdaptiveResourcePool<Resource>;
+using InlinePool = AdaptiveResourcePool<Resource, InlineFunctionPoolPolicy<Resource>>;
+using ShardedPool = ShardedAdaptiveResourcePool<Resource>;
+using Rng = std::minstd_rand;
+
+std::atomic<bool> g_failed { false };
+
+void fail(const char* what) {
+    if (!g_failed.exchange(true)) {
+        std::fprintf(stderr, "invariant violated: %s\n", what);
+    }
+}
+
+void check(bool ok, const char* what) {
+    if (!ok) {
+        fail(what);
+    }
+}
+
+void use(Resource* res) {
+    if (res->holders.fetch_add(1) != 0) {
+        fail("resource held by two callers");
+    }
+    std::this_thread::yield();
+    res->holders.fetch_sub(1);
+}
+
+/// Runs `op` on `threads` threads until `duration` has passed. Returns the
+/// number of operations run.
+template<typename Op>
+uint64_t hammer(size_t threads, std::chrono::milliseconds duration, Op op) {
+    std::atomic<bool> stop { false };
+    std::atomic<uint64_t> ops { 0 };
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            Rng rng(static_cast<unsigned>(t + 1));
+            while (!stop.load(std::memory_order_relaxed)) {
+                op(rng);
+                ops.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto& w: workers) {
+        w.join();
+    }
+    return ops.load();
+}
+
+/// A heap pool of `size` resources that checks nothing is released while held.
+Pool::Params makeParams(size_t size) {
+    Pool::Params params;
+    params.resource_initializer = [size]() {
+        std::vector<std::unique_ptr<Resource>> res;
+        for (size_t i = 0; i < size; ++i) {
+            res.push_back(std::make_unique<Resource>(i));
+        }
+        return res;
+    };
+    params.restore_func = [](size_t index) {
+        return std::make_unique<Resource>(index);
+    };
+    params.release_func = [](std::unique_ptr<Resource>& res) {
+        if (res->holders.load() != 0) {
+            fail("released while held");
+        }
+    };
+    return params;
+}
+
+/// Every resource has come back and none is stuck between states.
+template<typename P>
+void checkSettled(P& pool, const char* what) {
+    check(pool.busyCount() == 0, what);
+    check(pool.idleCount() <= pool.activeCount(), what);
+    for (const PoolSlotSnapshot& slot: pool.snapshot()) {
+        check(slot.status == PoolSlotStatus::Idle || slot.status == PoolSlotStatus::Released, what);
+    }
+}
+
+#if defined(__cpp_lib_coroutine)
+/// Eagerly started coroutine that signals completion from its final suspend,
+/// so the frame may be destroyed by whichever thread sees `done`.
+struct Task {
+    struct promise_type {
+        std::atomic<bool> done { false };
+
+        Task get_return_object() {
+            return Task { std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept {
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                h.promise().done.store(true, std::memory_order_release);
+            }
+
+            void await_resume() noexcept {}
+        };
+
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> h): handle(h) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        handle.destroy();
+    }
+
+    /// Blocks the calling thread until the coroutine has finished.
+    void join() const {
+        while (!handle.promise().done.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+Task useAsync(Pool& pool) {
+    if (Pool::Lease lease = co_await pool.asyncAcquire()) {
+        use(lease.get());
+    } else {
+        fail("co_await yielded an empty lease");
+    }
+}
+#endif
+
+/// Every acquire flavour against flapping policies, a growable pool and
+/// thread caches.
+uint64_t checkMixed(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    Pool::Params params = makeParams(size);
+    params.can_restore = [size](size_t active) { return active < size; };
+    params.should_release = [size](size_t active) { return active > size / 2; };
+    params.max_size = size * 2;
+    params.thread_cache_size = 2;
+
+    Pool pool(params);
+    const uint64_t ops = hammer(threads, duration, [&](Rng& rng) {
+        std::vector<Pool::Handle> batch;
+        switch (rng() % 6) {
+        case 0:
+            if (Resource* res = pool.acquire()) {
+                use(res);
+                pool.release(res);
+            }
+            break;
+        case 1:
+            if (auto lease = pool.acquireLease()) {
+                use(lease.get());
+            }
+            break;
+        case 2:
+            if (auto lease = pool.acquireLeaseFor(std::chrono::milliseconds(5))) {
+                use(lease.get());
+            }
+            break;
+        case 3:
+            if (pool.acquireN(2, batch)) {
+                use(batch[0].get());
+                use(batch[1].get());
+                pool.releaseN(batch);
+            }
+            break;
+        case 4:
+#if defined(__cpp_lib_coroutine)
+            useAsync(pool).join();
+#endif
+            break;
+        default:
+            pool.trim();
+            break;
+        }
+    });
+
+    // The workers' thread caches were handed back when they exited.
+    pool.trim();
+    check(pool.activeCount() <= pool.slotCount(), "more active resources than slots");
+    checkSettled(pool, "mixed: slots not settled");
+    return ops;
+}
+
+/// Normal and Low never dip into the High reservation; Low stays within
+/// its quota.
+void checkPriorities(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    constexpr size_t kReserved = 2;
+    constexpr size_t kLowQuota = 2;
+    Pool::Params params = makeParams(size);
+    params.reserved_for_high = kReserved;
+    params.priority_quota[static_cast<size_t>(AcquirePriority::Low)] = kLowQuota;
+
+    Pool pool(params);
+    // Raised after an acquire and lowered before its release, so they never
+    // exceed what the pool itself counts.
+    std::atomic<size_t> low { 0 }, unreserved { 0 };
+    hammer(threads, duration, [&](Rng& rng) {
+        const auto priority = static_cast<AcquirePriority>(rng() % kAcquirePriorityCount);
+        auto lease = pool.acquireLeaseFor(std::chrono::milliseconds(1), priority);
+        if (!lease)
+            return;
+        const bool is_low = priority == AcquirePriority::Low;
+        const bool is_high = priority == AcquirePriority::High;
+        if (is_low && low.fetch_add(1) >= kLowQuota) {
+            fail("priorities: Low over its quota");
+        }
+        if (!is_high && unreserved.fetch_add(1) >= size - kReserved) {
+            fail("priorities: reservation for High taken by a lower class");
+        }
+        use(lease.get());
+        if (is_low) {
+            low.fetch_sub(1);
+        }
+        if (!is_high) {
+            unreserved.fetch_sub(1);
+        }
+    });
+    checkSettled(pool, "priorities: slots not settled");
+}
+
+/// No resource failing validate is handed out, and every discarded one is
+/// restored even though can_restore is not set.
+void checkValidation(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    Pool::Params params = makeParams(size);
+    params.validate = [](Resource& res) { return !res.broken.load(); };
+
+    Pool pool(params);
+    hammer(threads, duration, [&](Rng& rng) {
+        if (auto lease = pool.acquireLeaseFor(std::chrono::milliseconds(5))) {
+            check(!lease->broken.load(), "validation: handed out a resource failing validate");
+            use(lease.get());
+            if (rng() % 8 == 0) {
+                lease->broken = true;
+            }
+        }
+    });
+
+    std::vector<Pool::Lease> all;
+    for (size_t i = 0; i < size; ++i) {
+        if (auto lease = pool.acquireLeaseFor(std::chrono::seconds(1))) {
+            all.push_back(std::move(lease));
+        }
+    }
+    check(all.size() == size, "validation: discarded slots were not restored");
+    all.clear();
+    checkSettled(pool, "validation: slots not settled");
+}
+
+/// Keyed acquires share slots safely and give them all back.
+void checkAffinity(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    Pool pool(makeParams(size));
+    hammer(threads, duration, [&](Rng& rng) {
+        if (auto lease = pool.acquireLease(Pool::AffinityKey { rng() % 4 + 1 })) {
+            use(lease.get());
+        }
+    });
+    checkSettled(pool, "affinity: slots not settled");
+    check(pool.idleCount() == size, "affinity: idle slots missing");
+}
+
+/// Idle slots expire down to min_size and never below.
+void checkIdleTtl(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    constexpr size_t kMinSize = 2;
+    Pool::Params params = makeParams(size);
+    params.idle_ttl = std::chrono::milliseconds(1);
+    params.min_size = kMinSize;
+    params.max_size = size * 2;
+    params.can_restore = [](size_t) { return true; };
+
+    Pool pool(params);
+    hammer(threads, duration, [&](Rng& rng) {
+        if (auto lease = pool.acquireLeaseFor(std::chrono::milliseconds(1))) {
+            use(lease.get());
+        }
+        if (rng() % 16 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    pool.evictIdle();
+    checkSettled(pool, "idle ttl: slots not settled");
+    check(pool.activeCount() == kMinSize, "idle ttl: idle slots not evicted down to min_size");
+}
+
+/// Restore, release, eviction and health checks on the maintenance thread
+/// race acquirers without breaking any invariant.
+void checkMaintenance(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    Pool::Params params = makeParams(size);
+    params.maintenance_interval = std::chrono::milliseconds(1);
+    params.health_check_interval = std::chrono::milliseconds(1);
+    params.idle_ttl = std::chrono::milliseconds(2);
+    params.validate = [](Resource& res) { return !res.broken.load(); };
+    params.can_restore = [size](size_t active) { return active < size; };
+    params.should_release = [size](size_t active) { return active > size / 2; };
+    params.max_size = size * 2;
+
+    Pool pool(params);
+    hammer(threads, duration, [&](Rng& rng) {
+        if (auto lease = pool.acquireLeaseFor(std::chrono::milliseconds(2))) {
+            check(!lease->broken.load(), "maintenance: handed out a resource failing validate");
+            use(lease.get());
+            if (rng() % 32 == 0) {
+                lease->broken = true;
+            }
+        }
+    });
+    check(pool.activeCount() <= pool.slotCount(), "maintenance: more active resources than slots");
+    check(pool.busyCount() == 0, "maintenance: resources still held");
+}
+
+/// Parallel warm-up whose restores first fail and throw still fills every
+/// initial slot, while acquirers take slots as they appear.
+void checkWarmup(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    std::unique_ptr<std::atomic<int>[]> attempts(new std::atomic<int>[size] {});
+    Pool::Params params = makeParams(size);
+    params.warmup = WarmupMode::Parallel;
+    params.initial_size = size;
+    params.warmup_threads = 2;
+    params.restore_func = [&attempts](size_t index) -> std::unique_ptr<Resource> {
+        if (attempts[index].fetch_add(1) == 0) {
+            if (index % 2 != 0)
+                throw std::runtime_error("restore failed");
+            return nullptr;
+        }
+        return std::make_unique<Resource>(index);
+    };
+
+    Pool pool(params);
+    hammer(threads, duration, [&](Rng&) {
+        if (auto lease = pool.acquireLeaseFor(std::chrono::milliseconds(5))) {
+            use(lease.get());
+        }
+    });
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (pool.activeCount() < size && std::chrono::steady_clock::now() < deadline) {
+        pool.acquireLease();
+        std::this_thread::yield();
+    }
+    check(pool.activeCount() == size, "warm-up: failed initial slots were not retried");
+    checkSettled(pool, "warm-up: slots not settled");
+}
+
+/// The in-place storage policy under the same flapping policies as the
+/// mixed run.
+void checkInline(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    InlinePool::Params params;
+    params.initial_size = size;
+    params.max_size = size * 2;
+    params.construct_func = [](Resource* where, size_t index) {
+        ::new (where) Resource(index);
+        return true;
+    };
+    params.release_func = [](Resource& res) {
+        if (res.holders.load() != 0) {
+            fail("inline: released while held");
+        }
+    };
+    params.can_restore = [size](size_t active) { return active < size; };
+    params.should_release = [size](size_t active) { return active > size / 2; };
+
+    InlinePool pool(params);
+    hammer(threads, duration, [&](Rng& rng) {
+        if (rng() % 4 == 0) {
+            pool.trim();
+        } else if (auto lease = pool.acquireLeaseFor(std::chrono::milliseconds(2))) {
+            check(lease->id == lease.index(), "inline: resource does not live in its slot");
+            use(lease.get());
+        }
+    });
+    checkSettled(pool, "inline: slots not settled");
+}
+
+/// Handles and leases of the sharded pool go back to the shard they came from.
+void checkSharded(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    ShardedPool pool(ShardedPool::replicate(makeParams(std::max<size_t>(size / 2, 1)), 2));
+    hammer(threads, duration, [&](Rng& rng) {
+        if (rng() % 2 == 0) {
+            if (auto h = pool.acquireHandle()) {
+                use(h.resource);
+                pool.release(h);
+            }
+        } else if (auto lease = pool.acquireLeaseFor(std::chrono::milliseconds(2))) {
+            use(lease.get());
+        }
+    });
+    check(pool.busyCount() == 0, "sharded: resources still held");
+    check(pool.idleCount() == pool.activeCount(), "sharded: idle slots missing");
+}
+
+/// Releasing a handle twice, or a copy kept after its slot moved on, is
+/// rejected every time and never frees a slot someone else holds.
+void checkStaleHandles(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    std::atomic<uint64_t> expected { 0 }, rejected { 0 };
+    Pool::Params params = makeParams(size);
+    params.event_logger = [&rejected](const PoolLogRecord& record) {
+        if (record.event == PoolEvent::StaleRelease) {
+            rejected.fetch_add(1);
+        }
+    };
+
+    Pool pool(params);
+    hammer(threads, duration, [&](Rng& rng) {
+        Pool::Handle h = pool.acquireHandle();
+        if (!h)
+            return;
+        use(h.get());
+        pool.release(h);
+        pool.release(h);
+        expected.fetch_add(1);
+        // The slot may be held by another caller by now.
+        if (rng() % 2 == 0) {
+            std::this_thread::yield();
+            pool.release(h);
+            expected.fetch_add(1);
+        }
+    });
+    check(rejected.load() == expected.load(), "generations: a stale release was not rejected");
+    checkSettled(pool, "generations: slots not settled");
+    check(pool.idleCount() == size, "generations: idle slots missing");
+}
+
+/// Threads alternating between two pools of one type, then exiting, leave no
+/// slot parked in a thread cache.
+void checkThreadCaches(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    Pool::Params params = makeParams(size);
+    params.thread_cache_size = 2;
+
+    Pool first(params), second(params);
+    hammer(threads, duration, [&](Rng& rng) {
+        Pool& pool = rng() % 2 == 0 ? first : second;
+        if (auto lease = pool.acquireLease()) {
+            use(lease.get());
+        }
+    });
+    checkSettled(first, "thread cache: slots of the first pool left parked");
+    checkSettled(second, "thread cache: slots of the second pool left parked");
+    check(first.idleCount() == size && second.idleCount() == size, "thread cache: idle slots missing");
+}
+
+/// restore_func and release_func throwing at random strand no slot.
+void checkThrowingCallbacks(size_t threads, std::chrono::milliseconds duration, size_t size) {
+    std::atomic<uint64_t> calls { 0 };
+    Pool::Params params = makeParams(size);
+    params.restore_func = [&calls](size_t index) {
+        if (calls.fetch_add(1) % 4 == 0)
+            throw std::runtime_error("restore failed");
+        return std::make_unique<Resource>(index);
+    };
+    params.release_func = [&calls](std::unique_ptr<Resource>&) {
+        if (calls.fetch_add(1) % 4 == 0)
+            throw std::runtime_error("release failed");
+    };
+    params.can_restore = [size](size_t active) { return active < size; };
+    params.should_release = [size](size_t active) { return active > size / 2; };
+
+    Pool pool(params);
+    hammer(threads, duration, [&](Rng& rng) {
+        try {
+            if (rng() % 4 == 0) {
+                pool.trim();
+            } else if (auto lease = pool.acquireLease()) {
+                use(lease.get());
+            }
+        } catch (const std::runtime_error&) {
+        }
+    });
+    checkSettled(pool, "throwing callbacks: slots stranded");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const size_t threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+    const long seconds = argc > 2 ? std::strtol(argv[2], nullptr, 10) : 2;
+    const size_t size = std::max<size_t>(argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 8, 4);
+
+    const std::chrono::milliseconds mixed(seconds * 1000);
+    const std::chrono::milliseconds slice(std::max<long>(seconds * 100, 100));
+
+    const uint64_t ops = checkMixed(threads, mixed, size);
+    checkPriorities(threads, slice, size);
+    checkValidation(threads, slice, size);
+    checkAffinity(threads, slice, size);
+    checkIdleTtl(threads, slice, size);
+    checkMaintenance(threads, slice, size);
+    checkWarmup(threads, slice, size);
+    checkInline(threads, slice, size);
+    checkSharded(threads, slice, size);
+    checkStaleHandles(threads, slice, size);
+    checkThreadCaches(threads, slice, size);
+    checkThrowingCallbacks(threads, slice, size);
+    check(Resource::live.load() == 0, "resources leaked by a destroyed pool");
+
+    std::printf(
+        "%llu operations on %zu threads in %lds: %s\n",
+        static_cast<unsigned long long>(ops),
+        threads,
+        seconds,
+        g_failed ? "FAILED" : "ok"
+    );
+    return g_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+// Compares SlotLayout::Packed and SlotLayout::Padded under concurrent
+// acquire/release traffic.
+//
+// Build with CMake, or directly with Google Benchmark:
+//   g++ -O2 -std=c++17 -I.. slot_layout_bench.cpp -lbenchmark -lpthread -o slot_layout_bench
+
+#include "../adaptive_resource_pool.hpp"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+struct Buffer {
+    size_t id;
+};
+
+std::unique_ptr<AdaptiveResourcePool<Buffer>> g_pool;
+
+AdaptiveResourcePool<Buffer>::Params makeParams(size_t size, SlotLayout layout) {
+    AdaptiveResourcePool<Buffer>::Params params;
+    params.resource_initializer = [size]() {
+        std::vector<std::unique_ptr<Buffer>> res;
+        for (size_t i = 0; i < size; ++i) {
+            res.push_back(std::make_unique<Buffer>(Buffer { i }));
+        }
+        return res;
+    };
+    params.release_func = [](std::unique_ptr<Buffer>&) {};
+    params.slot_layout = layout;
+    return params;
+}
+
+// Every thread keeps acquiring and returning a slot. Concurrent threads end up
+// on different but neighbouring slots, whose states share a cache line in the
+// packed layout.
+void BM_AcquireRelease(benchmark::State& state, SlotLayout layout) {
+    if (state.thread_index() == 0) {
+        g_pool = std::make_unique<AdaptiveResourcePool<Buffer>>(
+            makeParams(static_cast<size_t>(state.range(0)), layout)
+        );
+    }
+    for (auto _: state) {
+        auto h = g_pool->acquireHandle();
+        benchmark::DoNotOptimize(h.resource);
+        if (h) {
+            g_pool->release(h);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        g_pool.reset();
+    }
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(BM_AcquireRelease, packed, SlotLayout::Packed)
+    ->Arg(8)
+    ->Arg(64)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_AcquireRelease, padded, SlotLayout::Padded)
+    ->Arg(8)
+    ->Arg(64)
+    ->ThreadRange(1, 16)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
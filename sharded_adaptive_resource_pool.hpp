@@ -0,0 +1,380 @@
+#pragma once
+
+#include "adaptive_resource_pool.hpp"
+
+#include <type_traits>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 29)
+#define ADAPTIVE_POOL_HAS_GETCPU 1
+#endif
+#endif
+#endif
+
+inline namespace ADAPTIVE_POOL_ABI_NAMESPACE {
+
+/// NUMA node of the CPU the calling thread runs on, or 0 if unknown.
+/// Uses getcpu() (served from the vDSO) where glibc has it; otherwise the
+/// system call result is cached per thread and refreshed every 256 calls,
+/// as a thread only changes node when the scheduler migrates it.
+inline size_t currentNumaNode() noexcept {
+#if defined(ADAPTIVE_POOL_HAS_GETCPU)
+    unsigned cpu = 0;
+    unsigned node = 0;
+    if (getcpu(&cpu, &node) == 0)
+        return node;
+#elif defined(__linux__) && defined(SYS_getcpu)
+    static thread_local unsigned node = 0;
+    static thread_local unsigned calls = 0;
+    if (calls++ % 256 == 0) {
+        unsigned cpu = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+            node = 0;
+    }
+    return node;
+#endif
+    return 0;
+}
+
+/// CPU the calling thread runs on, or 0 if unknown. sched_getcpu() reads
+/// it from the vDSO without entering the kernel.
+inline size_t currentCpu() noexcept {
+#if defined(__linux__)
+    const int cpu = sched_getcpu();
+    if (cpu >= 0)
+        return static_cast<size_t>(cpu);
+#endif
+    return 0;
+}
+
+/// Stable hash of the calling thread, computed once per thread. Thread ids
+/// are often aligned addresses, so they are mixed to spread the low bits.
+inline size_t currentThreadHash() noexcept {
+    static thread_local const size_t hash = [] {
+        uint64_t h = std::hash<std::thread::id> {}(std::this_thread::get_id());
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return static_cast<size_t>(h ^ (h >> 31));
+    }();
+    return hash;
+}
+
+/// How a ShardedAdaptiveResourcePool picks the local shard of a thread
+/// when Params::locality is not set.
+enum class ShardSelection {
+    NumaNode, ///< currentNumaNode(): keeps memory traffic on the socket
+    Cpu,      ///< currentCpu(): one shard per CPU spreads contention furthest
+    Thread,   ///< currentThreadHash(): stable even when threads migrate
+};
+
+/// ShardedAdaptiveResourcePool partitions resources into shards, e.g. one per
+/// NUMA node or device. Each shard is a complete AdaptiveResourcePool with
+/// its own slot states, lock and release/restore policies.
+/// acquire() tries the caller's local shard first and steals from the other
+/// shards only when it has nothing available.
+///
+/// Sharding also lifts the scaling limit of a single pool: threads spread
+/// over shards contend on different locks, counters and slot arrays.
+template<typename T, typename Policy = FunctionPoolPolicy<T>>
+class ShardedAdaptiveResourcePool {
+public:
+    using Pool = AdaptiveResourcePool<T, Policy>;
+    using Lease = typename Pool::Lease;
+
+    struct Params {
+        /// Parameters of each shard. Their resource_initializer and restore_func
+        /// should create resources bound to that shard's node or device.
+        std::vector<typename Pool::Params> shards;
+
+        /// Returns the shard local to the calling thread (taken modulo the
+        /// number of shards), e.g. its GPU. Overrides selection.
+        std::function<size_t()> locality;
+
+        /// Local shard of a thread when locality is not set.
+        ShardSelection selection = ShardSelection::NumaNode;
+
+        /// Evaluate the can_restore and should_release callbacks of every shard
+        /// against the active count of the whole pool instead of the shard's,
+        /// so thresholds are written for global load. Each shard still
+        /// restores and releases its own slots. Requires FunctionPoolPolicy.
+        bool global_policy = false;
+
+        /// While a blocking acquire waits on the local shard, other shards are
+        /// checked for a free resource this often.
+        std::chrono::microseconds steal_interval { 1000 };
+    };
+
+    /// An acquired resource together with the shard and slot it occupies.
+    struct Handle {
+        T* resource = nullptr;   ///< Acquired resource, nullptr if acquisition failed
+        size_t index = 0;        ///< Slot index within the shard
+        size_t shard = 0;        ///< Shard the resource belongs to
+        uint32_t generation = 0; ///< Hand-out of the slot; see Pool::Handle
+
+        explicit operator bool() const noexcept {
+            return resource != nullptr;
+        }
+
+        T* get() const noexcept {
+            return resource;
+        }
+
+        T* operator->() const noexcept {
+            return resource;
+        }
+    };
+
+    /// Parameters for `count` shards configured alike. Each shard calls the
+    /// resource_initializer of `shard` for its own resources.
+    static Params replicate(const typename Pool::Params& shard, size_t count) {
+        Params params;
+        params.shards.assign(count, shard);
+        return params;
+    }
+
+    /// Constructs one shard per entry of params.shards.
+    explicit ShardedAdaptiveResourcePool(const Params& params):
+        locality_(params.locality),
+        global_policy_(params.global_policy),
+        steal_interval_(params.steal_interval),
+        guards_(std::make_unique<ShardGuard[]>(params.shards.size())) {
+        shards_.reserve(params.shards.size());
+        for (size_t k = 0; k < params.shards.size(); ++k) {
+            typename Pool::Params shard_params = params.shards[k];
+            globalize(shard_params, k);
+            shards_.push_back(std::make_unique<Pool>(shard_params));
+        }
+        if (!locality_) {
+            switch (params.selection) {
+            case ShardSelection::NumaNode:
+                locality_ = [] { return currentNumaNode(); };
+                break;
+            case ShardSelection::Cpu:
+                locality_ = [] { return currentCpu(); };
+                break;
+            case ShardSelection::Thread:
+                locality_ = [] { return currentThreadHash(); };
+                break;
+            }
+        }
+        open_.store(true);
+    }
+
+    /// Destroys every shard. Global policy callbacks that shard maintenance
+    /// runs meanwhile see the pool closed and decline.
+    ~ShardedAdaptiveResourcePool() {
+        open_.store(false);
+        for (size_t k = 0; k < shards_.size(); ++k) {
+            while (guards_[k].readers.load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+        shards_.clear();
+    }
+
+    ShardedAdaptiveResourcePool(const ShardedAdaptiveResourcePool&) = delete;
+    ShardedAdaptiveResourcePool& operator=(const ShardedAdaptiveResourcePool&) = delete;
+
+    /// Acquires a resource together with its shard, local shard first.
+    /// Returns an empty handle if no shard has one available.
+    /// `priority` applies per shard, against each shard's own reservation and
+    /// quotas.
+    Handle acquireHandle(AcquirePriority priority = AcquirePriority::Normal) {
+        return shards_.empty() ? Handle {} : acquireHandleFrom(localShard(), priority);
+    }
+
+    /// Acquires a resource as a Lease of the shard it belongs to.
+    /// Returns an empty lease if no shard has one available.
+    Lease acquireLease(AcquirePriority priority = AcquirePriority::Normal) {
+        return shards_.empty() ? Lease {} : acquireLeaseFrom(localShard(), priority);
+    }
+
+    /// Acquires a resource, blocking up to `timeout`. The caller queues on its
+    /// local shard and checks the others every Params::steal_interval.
+    template<typename Rep, typename Period>
+    Handle acquireHandleFor(
+        const std::chrono::duration<Rep, Period>& timeout,
+        AcquirePriority priority = AcquirePriority::Normal
+    ) {
+        const size_t local = localShard();
+        return waitFor(
+            timeout,
+            [this, local, priority] { return acquireHandleFrom(local, priority); },
+            [this, local, priority](auto deadline) -> Handle {
+                auto h = shards_[local]->acquireHandleUntil(deadline, priority);
+                return { h.resource, h.index, local, h.generation };
+            }
+        );
+    }
+
+    /// Lease variant of acquireHandleFor().
+    template<typename Rep, typename Period>
+    Lease acquireLeaseFor(
+        const std::chrono::duration<Rep, Period>& timeout,
+        AcquirePriority priority = AcquirePriority::Normal
+    ) {
+        const size_t local = localShard();
+        return waitFor(
+            timeout,
+            [this, local, priority] { return acquireLeaseFrom(local, priority); },
+            [this, local, priority](auto deadline) { return shards_[local]->acquireLeaseUntil(deadline, priority); }
+        );
+    }
+
+    /// Releases a resource acquired through acquireHandle() to its shard.
+    /// Handles naming a shard that does not exist are ignored.
+    void release(const Handle& handle) {
+        if (handle.shard >= shards_.size()) {
+            return;
+        }
+        shards_[handle.shard]->release(typename Pool::Handle { handle.resource, handle.index, handle.generation });
+    }
+
+    /// Replaces the policy of every shard; see Pool::updatePolicy(). With
+    /// Params::global_policy the new thresholds see the pool-wide active count
+    /// too, which calling shard(i).updatePolicy() directly bypasses.
+    void updatePolicy(const Policy& policy) {
+        for (size_t k = 0; k < shards_.size(); ++k) {
+            Policy shard_policy = policy;
+            globalize(shard_policy, k);
+            shards_[k]->updatePolicy(std::move(shard_policy));
+        }
+    }
+
+    /// Returns the number of idle resources over all shards.
+    /// Sums one relaxed counter per shard; the result is a snapshot.
+    size_t idleCount() const {
+        size_t total = 0;
+        for (const auto& s: shards_) {
+            total += s->idleCount();
+        }
+        return total;
+    }
+
+    /// Returns the number of active resources over all shards.
+    size_t activeCount() const {
+        size_t total = 0;
+        for (const auto& s: shards_) {
+            total += s->activeCount();
+        }
+        return total;
+    }
+
+    /// Returns the number of resources held by callers over all shards.
+    size_t busyCount() const {
+        size_t total = 0;
+        for (const auto& s: shards_) {
+            total += s->busyCount();
+        }
+        return total;
+    }
+
+    size_t shardCount() const noexcept {
+        return shards_.size();
+    }
+
+    /// Direct access to shard `i`, e.g. for per-shard introspection or trim().
+    Pool& shard(size_t i) noexcept {
+        return *shards_[i];
+    }
+
+    /// Shard local to the calling thread.
+    size_t localShard() const {
+        return shards_.empty() ? 0 : locality_() % shards_.size();
+    }
+
+private:
+    /// Callers of a shard's global policy callbacks that may be reading other
+    /// shards' counters. One per shard, so shards do not contend on it.
+    struct alignas(kAdaptivePoolCacheLineSize) ShardGuard {
+        std::atomic<size_t> readers { 0 };
+    };
+
+    /// Applies Params::global_policy to the policy of shard `k`.
+    void globalize(Policy& policy, size_t k) {
+        if constexpr (std::is_same_v<Policy, FunctionPoolPolicy<T>>) {
+            if (global_policy_) {
+                globalize(policy.can_restore, k);
+                globalize(policy.should_release, k);
+            }
+        }
+    }
+
+    /// Makes the count-based callback `decide` of shard `k` see the active
+    /// count of the whole pool.
+    void globalize(std::function<bool(size_t)>& decide, size_t k) {
+        if (!decide)
+            return;
+        decide = [this, k, local = std::move(decide)](size_t) {
+            std::atomic<size_t>& readers = guards_[k].readers;
+            readers.fetch_add(1);
+            // Pairs with the destructor clearing open_ before it checks readers.
+            const bool result = open_.load() && local(activeCount());
+            readers.fetch_sub(1);
+            return result;
+        };
+    }
+
+    /// Shard tried at step `k` of an acquire whose local shard is `local`:
+    /// the local one first, then the others. Each thread walks them from its
+    /// own offset, so threads that miss locally spread over the other shards
+    /// instead of all draining the next one.
+    size_t probeShard(size_t local, size_t k) const noexcept {
+        const size_t n = shards_.size();
+        if (k == 0)
+            return local;
+        return (local + 1 + (currentThreadHash() + k - 1) % (n - 1)) % n;
+    }
+
+    /// acquireHandle() with the local shard already chosen.
+    Handle acquireHandleFrom(size_t local, AcquirePriority priority) {
+        for (size_t k = 0; k < shards_.size(); ++k) {
+            const size_t s = probeShard(local, k);
+            if (auto h = shards_[s]->acquireHandle(priority))
+                return { h.resource, h.index, s, h.generation };
+        }
+        return {};
+    }
+
+    /// acquireLease() with the local shard already chosen.
+    Lease acquireLeaseFrom(size_t local, AcquirePriority priority) {
+        for (size_t k = 0; k < shards_.size(); ++k) {
+            if (auto lease = shards_[probeShard(local, k)]->acquireLease(priority))
+                return lease;
+        }
+        return {};
+    }
+
+    /// Alternates between waiting on the local shard for one steal_interval
+    /// (`wait_local`) and trying every shard (`try_all`) until `timeout`.
+    template<typename Rep, typename Period, typename TryAll, typename WaitLocal>
+    auto waitFor(const std::chrono::duration<Rep, Period>& timeout, TryAll try_all, WaitLocal wait_local) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        auto result = try_all();
+        if (result || shards_.empty())
+            return result;
+        for (;;) {
+            const auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+                return result;
+            const auto slice = std::min<std::chrono::steady_clock::duration>(deadline - now, steal_interval_);
+            if ((result = wait_local(now + slice)))
+                return result;
+            if ((result = try_all()))
+                return result;
+        }
+    }
+
+    std::vector<std::unique_ptr<Pool>> shards_; ///< Shards, each with its own state and lock
+    std::function<size_t()> locality_;          ///< Local shard of the calling thread
+    bool global_policy_ = false;                ///< Params::global_policy
+    std::chrono::microseconds steal_interval_;  ///< Remote check period of blocking acquires
+    std::unique_ptr<ShardGuard[]> guards_;      ///< Per-shard global policy readers
+    std::atomic<bool> open_ { false };          ///< Every shard exists and none is being destroyed
+};
+
+} // inline namespace ADAPTIVE_POOL_ABI_NAMESPACE